@@ -0,0 +1,196 @@
+/*Correctness check and throughput benchmark for the multipart/form-data parser (QueryParams::AppendFormMultipart()).
+It's a standalone program: it isn't part of the MiniWebSrv build.
+
+Compile and run from the repository root, for example:
+	g++ -std=c++17 -O2 -IMiniWebSrv Doc/MultipartBench.cpp MiniWebSrv/HTTP/QueryParams.cpp MiniWebSrv/HTTP/Header.cpp \
+		-lboost_filesystem -lboost_system -lboost_locale -o multipartbench
+	./multipartbench [BodySizeMB] [Seed]
+
+First, random bodies (with content full of partial boundary matches) are parsed in randomly sized chunks, and the
+parsed parts are compared with the generated ones. Then large bodies are parsed in ReadBuffSize chunks, as the
+connections do, and the parse speed is printed.*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "HTTP/QueryParams.h"
+#include "HTTP/BuildConfig.h"
+
+using namespace HTTP;
+
+/**Keeps the uploaded files in memory.*/
+class MemUploadHelper : public QueryParams::IFileUpdloadHelper
+{
+public:
+	std::vector<std::string> FileA;
+	unsigned long long TotalLength = 0;
+	bool IsStoring = true; //If false, only the length of the files is counted.
+
+	virtual std::tuple<boost::filesystem::path, bool> OnNewFile(const std::string &Name, const std::string &OrigFileName, const std::string &MimeType) override
+	{
+		FileA.emplace_back();
+		return std::make_tuple(boost::filesystem::path(std::to_string(FileA.size())),true);
+	}
+
+	virtual bool OnFileData(const char *Begin, const char *End) override
+	{
+		if (IsStoring)
+			FileA.back().append(Begin,End);
+
+		TotalLength+=End-Begin;
+		return true;
+	}
+
+	virtual void OnFileEnd() override { }
+	virtual void OnFileReplaced(const boost::filesystem::path &Path) override { }
+};
+
+static const char *Boundary="XyZ123abc";
+
+struct Part
+{
+	bool IsFile;
+	std::string Name, Content;
+};
+
+static std::string BuildBody(const std::vector<Part> &PartA)
+{
+	std::string Body;
+	for (const Part &CurrPart : PartA)
+	{
+		Body+=std::string("--") + Boundary + "\r\n";
+		if (CurrPart.IsFile)
+		{
+			Body+="Content-Disposition: form-data; name=\"" + CurrPart.Name + "\"; filename=\"a.bin\"\r\n"
+				"Content-Type: application/octet-stream\r\n\r\n";
+		}
+		else
+			Body+="Content-Disposition: form-data; name=\"" + CurrPart.Name + "\"\r\n\r\n";
+
+		Body+=CurrPart.Content;
+		Body+="\r\n";
+	}
+
+	Body+=std::string("--") + Boundary + "--\r\n";
+	return Body;
+}
+
+/**Parses the body in chunks.
+@param MaxChunkLength The chunks are random length, up to this, if IsRandomChunks is true.*/
+static void Parse(QueryParams &Query, const std::string &Body, std::size_t MaxChunkLength, bool IsRandomChunks, std::mt19937 &Rnd)
+{
+	Query.GetBoundaryStr()=Boundary;
+	Query.OnBoundaryParsed();
+
+	for (std::size_t Pos=0; Pos<Body.size(); )
+	{
+		std::size_t ChunkLength=IsRandomChunks ? 1 + Rnd()%MaxChunkLength : MaxChunkLength;
+		ChunkLength=std::min(ChunkLength,Body.size()-Pos);
+		Query.AppendFormMultipart(Body.data() + Pos,Body.data() + Pos + ChunkLength);
+		Pos+=ChunkLength;
+	}
+}
+
+static bool CheckParser(std::mt19937 &Rnd)
+{
+	//Content made of the boundary's characters, so it has a lot of partial boundary matches.
+	static const std::string Alphabet=std::string("\r\n-") + Boundary + "q";
+
+	for (unsigned int Iter=0; Iter!=5000; ++Iter)
+	{
+		std::vector<Part> PartA(1 + Rnd()%4);
+		for (std::size_t PartI=0; PartI!=PartA.size(); ++PartI)
+		{
+			Part &CurrPart=PartA[PartI];
+			CurrPart.IsFile=Rnd()%2;
+			CurrPart.Name=(CurrPart.IsFile ? "f" : "p") + std::to_string(PartI);
+			for (std::size_t ContentLength=Rnd()%300; ContentLength; --ContentLength)
+				CurrPart.Content+=Alphabet[Rnd()%Alphabet.size()];
+		}
+
+		std::string Body=BuildBody(PartA);
+
+		MemUploadHelper UploadHelper;
+		QueryParams Query(&UploadHelper);
+		Parse(Query,Body,40,true,Rnd);
+
+		std::size_t FileI=0;
+		for (const Part &CurrPart : PartA)
+		{
+			bool IsMatching;
+			if (CurrPart.IsFile)
+				IsMatching=(FileI<UploadHelper.FileA.size()) && (UploadHelper.FileA[FileI++]==CurrPart.Content) &&
+					(Query.Files().count(CurrPart.Name));
+			else
+				IsMatching=Query.Get(CurrPart.Name,"\x01")==CurrPart.Content;
+
+			if (!IsMatching)
+			{
+				std::cout << "Mismatch in body #" << Iter << ", part \"" << CurrPart.Name << "\"." << std::endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void Benchmark(const char *Name, const std::string &Content, std::mt19937 &Rnd)
+{
+	std::string Body=BuildBody({ { true, "f", Content } });
+
+	double BestTime=0.0;
+	for (unsigned int Round=0; Round!=5; ++Round)
+	{
+		MemUploadHelper UploadHelper;
+		UploadHelper.IsStoring=false;
+		QueryParams Query(&UploadHelper);
+
+		std::chrono::steady_clock::time_point StartTime=std::chrono::steady_clock::now();
+		Parse(Query,Body,BuildConfig::ReadBuffSize,false,Rnd);
+		double CurrTime=std::chrono::duration<double>(std::chrono::steady_clock::now()-StartTime).count();
+
+		if (UploadHelper.TotalLength!=Content.size())
+		{
+			std::cout << Name << ": parse error." << std::endl;
+			return;
+		}
+
+		if ((!Round) || (CurrTime<BestTime))
+			BestTime=CurrTime;
+	}
+
+	std::cout << Name << ": " << (unsigned long long)(Body.size()/BestTime/(1024*1024)) << " MB/s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	std::size_t BodySize=(argc>1 ? atoi(argv[1]) : 256)*(std::size_t)1024*1024;
+	std::mt19937 Rnd(argc>2 ? atoi(argv[2]) : 1);
+
+	if (!CheckParser(Rnd))
+		return 1;
+
+	std::cout << "Parser check passed." << std::endl;
+
+	std::string Content(BodySize,'\0');
+	for (char &CurrC : Content)
+		CurrC=(char)Rnd();
+
+	Benchmark("Random binary",Content,Rnd);
+
+	//Worst case: a partial boundary match every few bytes.
+	static const char *NearMatchStr="\r\n--XyZ1";
+	for (std::size_t Pos=0; Pos!=Content.size(); ++Pos)
+		Content[Pos]=NearMatchStr[Pos%strlen(NearMatchStr)];
+
+	Benchmark("Near-boundary text",Content,Rnd);
+	return 0;
+}
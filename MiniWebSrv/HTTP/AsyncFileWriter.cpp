@@ -0,0 +1,615 @@
+#include "AsyncFileWriter.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <boost/filesystem/fstream.hpp>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace HTTP;
+
+struct AsyncFileWriter::Operation
+{
+	enum TYPE
+	{
+		OP_OPEN,
+		OP_WRITE,
+		OP_CLOSE,
+		OP_DISCARD, //Close and delete the current file.
+		OP_DELETE, //Delete a closed file.
+	} Type;
+
+	unsigned int Generation; //The value of State::Generation, when the operation was queued.
+	boost::filesystem::path Path; //OP_OPEN and OP_DELETE only.
+	unsigned long long PreallocLength; //OP_OPEN only.
+	bool IsDirect; //OP_OPEN only.
+	std::vector<char> Data; //OP_WRITE only.
+	std::size_t QueuedSize; //The size added to State::QueuedLength for the operation.
+
+	/**@return The memory used by the operation, including the bookkeeping of the queue.*/
+	inline std::size_t GetMemorySize() const { return sizeof(Operation) + Path.native().size() + Data.capacity(); }
+	/**@return True, if the operation removes files: these aren't dropped, when the stream fails or it's aborted.*/
+	inline bool IsCleanup() const { return (Type==OP_DISCARD) || (Type==OP_DELETE); }
+};
+
+/**The file which is currently written by a stream. Only accessed by the writer thread, which processes the stream.*/
+struct AsyncFileWriter::OpenFile
+{
+	OpenFile()
+#ifndef _WIN32
+		: FD(-1), IsDirect(false), DirectBuff(nullptr), DirectLength(0), Length(0), PreallocLength(0)
+#endif
+	{ }
+	~OpenFile()
+	{
+		Close();
+#ifndef _WIN32
+		free(DirectBuff);
+#endif
+	}
+
+	boost::filesystem::path Path; //Only set while the file is open.
+
+#ifdef _WIN32
+	boost::filesystem::ofstream FileS;
+
+	bool Open(const boost::filesystem::path &NewPath, unsigned long long NewPreallocLength, bool NewIsDirect)
+	{
+		//Preallocation and unbuffered writes aren't supported.
+		Path=NewPath;
+		FileS.open(Path,std::ios_base::binary);
+		return FileS.is_open();
+	}
+
+	bool Write(const char *Begin, std::size_t WriteLength)
+	{
+		FileS.write(Begin,WriteLength);
+		return !FileS.fail();
+	}
+
+	bool Close()
+	{
+		Path.clear();
+		if (!FileS.is_open())
+			return true;
+
+		FileS.close();
+		return !FileS.fail();
+	}
+#else
+	int FD;
+	bool IsDirect; //True, if the file is opened with O_DIRECT: only whole blocks of DirectBuff are written.
+	char *DirectBuff; //Aligned buffer of BuildConfig::UploadWriteBlockSize bytes. Allocated for the first direct file.
+	std::size_t DirectLength; //The length of the data in DirectBuff.
+	unsigned long long Length, PreallocLength;
+
+	static const std::size_t DirectAlignment = 4096;
+
+	bool Open(const boost::filesystem::path &NewPath, unsigned long long NewPreallocLength, bool NewIsDirect)
+	{
+		Path=NewPath;
+		Length=0;
+		PreallocLength=NewPreallocLength;
+		IsDirect=false;
+		DirectLength=0;
+
+		const int Flags=O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+		if ((NewIsDirect) &&
+			((DirectBuff) || (!posix_memalign((void **)&DirectBuff,DirectAlignment,BuildConfig::UploadWriteBlockSize))))
+		{
+			//Not every file system supports O_DIRECT (tmpfs doesn't, for example): then the file is opened normally.
+			FD=::open(Path.c_str(),Flags | O_DIRECT,0666);
+			IsDirect=FD!=-1;
+		}
+#endif
+		if (!IsDirect)
+			FD=::open(Path.c_str(),Flags,0666);
+
+		if (FD==-1)
+			return false;
+
+#ifdef __linux__
+		if (PreallocLength)
+			//Only an optimization: the blocks beyond the end of the file are released when the file is closed.
+			::fallocate(FD,FALLOC_FL_KEEP_SIZE,0,(off_t)PreallocLength);
+#endif
+
+		return true;
+	}
+
+	bool Write(const char *Begin, std::size_t WriteLength)
+	{
+		if (!IsDirect)
+			return WriteAll(Begin,WriteLength);
+
+		while (WriteLength)
+		{
+			std::size_t CopyLength=std::min<std::size_t>(WriteLength,BuildConfig::UploadWriteBlockSize-DirectLength);
+			memcpy(DirectBuff+DirectLength,Begin,CopyLength);
+			DirectLength+=CopyLength;
+			Begin+=CopyLength;
+			WriteLength-=CopyLength;
+
+			if (DirectLength==BuildConfig::UploadWriteBlockSize)
+			{
+				if (!WriteAll(DirectBuff,DirectLength))
+					return false;
+
+				DirectLength=0;
+			}
+		}
+
+		return true;
+	}
+
+	bool Close()
+	{
+		Path.clear();
+		if (FD==-1)
+			return true;
+
+		bool RetVal=true;
+		if ((IsDirect) && (DirectLength))
+		{
+			//The last partial block can't be written with O_DIRECT.
+			int Flags=fcntl(FD,F_GETFL);
+			RetVal=(Flags!=-1) && (fcntl(FD,F_SETFL,Flags & ~O_DIRECT)!=-1) && (WriteAll(DirectBuff,DirectLength));
+		}
+
+		if (PreallocLength)
+			RetVal=(!ftruncate(FD,(off_t)Length)) && (RetVal);
+
+		RetVal=(!::close(FD)) && (RetVal);
+		FD=-1;
+		return RetVal;
+	}
+
+	bool WriteAll(const char *Begin, std::size_t WriteLength)
+	{
+		while (WriteLength)
+		{
+			ssize_t Result=::write(FD,Begin,WriteLength);
+			if (Result<0)
+			{
+				if (errno==EINTR)
+					continue;
+
+				return false;
+			}
+
+			Begin+=Result;
+			WriteLength-=(std::size_t)Result;
+			Length+=(unsigned long long)Result;
+		}
+
+		return true;
+	}
+#endif
+
+	void Discard()
+	{
+		//Only the file which is still open is deleted: the closed ones belong to the caller.
+		boost::filesystem::path DelPath=Path;
+		Close();
+		if (!DelPath.empty())
+		{
+			boost::system::error_code DelErr;
+			boost::filesystem::remove(DelPath,DelErr);
+		}
+	}
+};
+
+struct AsyncFileWriter::Stream::State
+{
+	State() : QueuedLength(0), Generation(0), IsScheduled(false), IsFailed(false), IsFlushWait(false), WaitTim(nullptr)
+	{ }
+
+	std::mutex Mtx; //Protects the members below, except File.
+	std::deque<Operation> OpQ;
+	std::size_t QueuedLength; //The memory used by the operations in OpQ, and by the one which is executed.
+	unsigned int Generation; //Incremented by Abort(): the failures of the earlier operations are ignored.
+	bool IsScheduled; //True, if the stream is in the ready queue, or a writer thread is processing it.
+	bool IsFailed;
+	bool IsFlushWait; //True, if the waiting coroutine waits for every operation to finish.
+	boost::asio::basic_waitable_timer<std::chrono::steady_clock> *WaitTim; //Set while a coroutine waits on the stream.
+
+	OpenFile File;
+
+	/**Drops the queued operations, except for the cleanup. Mtx must be locked.*/
+	void DropOperations()
+	{
+		OpQ.erase(std::remove_if(OpQ.begin(),OpQ.end(),[this](const Operation &CurrOp)
+		{
+			if (CurrOp.IsCleanup())
+				return false;
+
+			QueuedLength-=CurrOp.QueuedSize;
+			return true;
+		}),OpQ.end());
+	}
+
+	/**Resumes the waiting coroutine, if it's wait condition is met. Mtx must be locked.*/
+	void WakeWaiter()
+	{
+		if ((WaitTim) &&
+			((IsFailed) || (IsFlushWait ? !IsScheduled : QueuedLength<=BuildConfig::UploadWriteQueueLength/2)))
+		{
+			//The coroutine can't resume before the handler runs on it's strand, so the timer is valid until then.
+			boost::asio::basic_waitable_timer<std::chrono::steady_clock> *Tim=WaitTim;
+			WaitTim=nullptr;
+			boost::asio::post(Tim->get_executor(), [Tim]() { Tim->cancel(); });
+		}
+	}
+};
+
+AsyncFileWriter::AsyncFileWriter(unsigned int ThreadCount) : IsStopping(false)
+{
+	ThreadA.reserve(std::max(ThreadCount,1U));
+	for (unsigned int x=0; x<std::max(ThreadCount,1U); ++x)
+		ThreadA.emplace_back(&AsyncFileWriter::ThreadFunc,this);
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	{
+		std::lock_guard<std::mutex> Lock(QueueMtx);
+		IsStopping=true;
+	}
+	QueueCV.notify_all();
+
+	for (std::thread &CurrTh : ThreadA)
+		CurrTh.join();
+}
+
+void AsyncFileWriter::Schedule(const std::shared_ptr<Stream::State> &Target)
+{
+	{
+		std::lock_guard<std::mutex> Lock(QueueMtx);
+		ReadyQ.push_back(Target);
+	}
+	QueueCV.notify_one();
+}
+
+void AsyncFileWriter::ThreadFunc()
+{
+	std::unique_lock<std::mutex> Lock(QueueMtx);
+	while (true)
+	{
+		if (ReadyQ.empty())
+		{
+			//The queued operations are finished before stopping.
+			if (IsStopping)
+				break;
+
+			QueueCV.wait(Lock);
+			continue;
+		}
+
+		std::shared_ptr<Stream::State> CurrStream=std::move(ReadyQ.front());
+		ReadyQ.pop_front();
+		Lock.unlock();
+
+		//One operation is executed at a time, so the streams are processed in turns.
+		if (Process(*CurrStream))
+			Schedule(CurrStream);
+
+		CurrStream.reset();
+		Lock.lock();
+	}
+}
+
+bool AsyncFileWriter::Process(Stream::State &Target)
+{
+	std::unique_lock<std::mutex> Lock(Target.Mtx);
+	Operation CurrOp=std::move(Target.OpQ.front());
+	Target.OpQ.pop_front();
+	Lock.unlock();
+
+	bool IsSuccess=true;
+	switch (CurrOp.Type)
+	{
+	case Operation::OP_OPEN:
+		IsSuccess=Target.File.Open(CurrOp.Path,CurrOp.PreallocLength,CurrOp.IsDirect);
+		break;
+	case Operation::OP_WRITE:
+		IsSuccess=Target.File.Write(CurrOp.Data.data(),CurrOp.Data.size());
+		break;
+	case Operation::OP_CLOSE:
+		IsSuccess=Target.File.Close();
+		break;
+	case Operation::OP_DISCARD:
+		Target.File.Discard();
+		break;
+	case Operation::OP_DELETE:
+	{
+		boost::system::error_code DelErr;
+		boost::filesystem::remove(CurrOp.Path,DelErr);
+		break;
+	}
+	}
+
+	if (!IsSuccess)
+		//Like the default upload handler, the partial file is kept until the uploaded files are deleted.
+		Target.File.Close();
+
+	Lock.lock();
+	Target.QueuedLength-=CurrOp.QueuedSize;
+	if ((!IsSuccess) && (CurrOp.Generation==Target.Generation))
+	{
+		//Drop the rest of the operations, except for the cleanup.
+		Target.IsFailed=true;
+		Target.DropOperations();
+	}
+
+	Target.IsScheduled=!Target.OpQ.empty();
+	Target.WakeWaiter();
+
+	return Target.IsScheduled;
+}
+
+AsyncFileWriter::Stream::Stream(AsyncFileWriter &Owner, const boost::asio::strand<boost::asio::io_context::executor_type> &Strand) :
+	Owner(Owner), MyState(std::make_shared<State>()), WakeTim(Strand), IsFileOpen(false)
+{
+}
+
+AsyncFileWriter::Stream::~Stream()
+{
+	Abort();
+}
+
+bool AsyncFileWriter::Stream::Open(const boost::filesystem::path &Path, unsigned long long PreallocLength, bool IsDirect)
+{
+	Operation NewOp;
+	NewOp.Type=Operation::OP_OPEN;
+	NewOp.Path=Path;
+	NewOp.PreallocLength=PreallocLength;
+	NewOp.IsDirect=IsDirect;
+
+	bool IsScheduleNeeded;
+	{
+		std::lock_guard<std::mutex> Lock(MyState->Mtx);
+		if (MyState->IsFailed)
+			return false;
+
+		IsScheduleNeeded=Push(std::move(NewOp));
+	}
+
+	IsFileOpen=true;
+	if (IsScheduleNeeded)
+		Owner.Schedule(MyState);
+
+	return true;
+}
+
+bool AsyncFileWriter::Stream::Write(const char *Begin, const char *End)
+{
+	std::size_t Length=End-Begin;
+	bool IsScheduleNeeded;
+	{
+		std::lock_guard<std::mutex> Lock(MyState->Mtx);
+		if (MyState->IsFailed)
+			return false;
+
+		std::deque<Operation> &OpQ=MyState->OpQ;
+		if ((!OpQ.empty()) && (OpQ.back().Type==Operation::OP_WRITE) &&
+			(OpQ.back().Data.size()+Length<=BuildConfig::UploadWriteBlockSize))
+		{
+			//Consecutive small writes are merged. The last queued operation isn't processed yet.
+			Operation &LastOp=OpQ.back();
+			LastOp.Data.insert(LastOp.Data.end(),Begin,End);
+
+			MyState->QueuedLength+=LastOp.GetMemorySize()-LastOp.QueuedSize;
+			LastOp.QueuedSize=LastOp.GetMemorySize();
+			IsScheduleNeeded=false;
+		}
+		else
+		{
+			Operation NewOp;
+			NewOp.Type=Operation::OP_WRITE;
+			NewOp.Data.assign(Begin,End);
+			IsScheduleNeeded=Push(std::move(NewOp));
+		}
+	}
+
+	if (IsScheduleNeeded)
+		Owner.Schedule(MyState);
+
+	return true;
+}
+
+void AsyncFileWriter::Stream::Close()
+{
+	if (!IsFileOpen)
+		return;
+
+	IsFileOpen=false;
+
+	bool IsScheduleNeeded;
+	{
+		std::lock_guard<std::mutex> Lock(MyState->Mtx);
+		if (MyState->IsFailed)
+			//The file was closed by the writer thread.
+			return;
+
+		Operation NewOp;
+		NewOp.Type=Operation::OP_CLOSE;
+		IsScheduleNeeded=Push(std::move(NewOp));
+	}
+
+	if (IsScheduleNeeded)
+		Owner.Schedule(MyState);
+}
+
+void AsyncFileWriter::Stream::Delete(const boost::filesystem::path &Path)
+{
+	Operation NewOp;
+	NewOp.Type=Operation::OP_DELETE;
+	NewOp.Path=Path;
+
+	bool IsScheduleNeeded;
+	{
+		std::lock_guard<std::mutex> Lock(MyState->Mtx);
+		IsScheduleNeeded=Push(std::move(NewOp));
+	}
+
+	if (IsScheduleNeeded)
+		Owner.Schedule(MyState);
+}
+
+bool AsyncFileWriter::Stream::Push(Operation &&NewOp)
+{
+	NewOp.Generation=MyState->Generation;
+	NewOp.QueuedSize=NewOp.GetMemorySize();
+	MyState->QueuedLength+=NewOp.QueuedSize;
+	MyState->OpQ.push_back(std::move(NewOp));
+
+	bool IsScheduleNeeded=!MyState->IsScheduled;
+	MyState->IsScheduled=true;
+	return IsScheduleNeeded;
+}
+
+bool AsyncFileWriter::Stream::IsFull()
+{
+	std::lock_guard<std::mutex> Lock(MyState->Mtx);
+	return MyState->QueuedLength>BuildConfig::UploadWriteQueueLength;
+}
+
+bool AsyncFileWriter::Stream::WaitForSpace(boost::asio::yield_context &Yield)
+{
+	return Wait(false,Yield);
+}
+
+bool AsyncFileWriter::Stream::Flush(boost::asio::yield_context &Yield)
+{
+	return Wait(true,Yield);
+}
+
+bool AsyncFileWriter::Stream::Wait(bool IsFlush, boost::asio::yield_context &Yield)
+{
+	std::unique_lock<std::mutex> Lock(MyState->Mtx);
+	while ((!MyState->IsFailed) &&
+		(IsFlush ? MyState->IsScheduled : MyState->QueuedLength>BuildConfig::UploadWriteQueueLength))
+	{
+		//The timer is cancelled by the writer thread, when the condition is met.
+		MyState->WaitTim=&WakeTim;
+		MyState->IsFlushWait=IsFlush;
+		Lock.unlock();
+
+		boost::system::error_code WaitErr;
+		WakeTim.expires_at(std::chrono::steady_clock::time_point::max());
+		WakeTim.async_wait(Yield[WaitErr]);
+
+		Lock.lock();
+	}
+
+	return !MyState->IsFailed;
+}
+
+void AsyncFileWriter::Stream::Abort()
+{
+	bool IsScheduleNeeded=false;
+	{
+		std::lock_guard<std::mutex> Lock(MyState->Mtx);
+		//A file might be open, if it's closing wasn't executed yet.
+		bool IsDiscardNeeded=(IsFileOpen) || (MyState->IsScheduled);
+
+		//The files replaced earlier are still deleted: they aren't in the uploaded files of the query any more.
+		MyState->DropOperations();
+		++MyState->Generation;
+		MyState->IsFailed=false;
+
+		if (IsDiscardNeeded)
+		{
+			Operation NewOp;
+			NewOp.Type=Operation::OP_DISCARD;
+			IsScheduleNeeded=Push(std::move(NewOp));
+		}
+	}
+
+	IsFileOpen=false;
+	if (IsScheduleNeeded)
+		Owner.Schedule(MyState);
+}
+
+AsyncFileUploadHelper::AsyncFileUploadHelper(const Config::FileUpload &Params,
+	const boost::asio::strand<boost::asio::io_context::executor_type> &Strand) :
+	Params(Params), MyStream(*Params.Writer,Strand),
+	IsFileValid(false), CurrFileSize(0), TotalFileSize(0), MaxRemainingLength(~0ULL)
+{
+}
+
+std::tuple<boost::filesystem::path, bool> AsyncFileUploadHelper::OnNewFile(const std::string &Name, const std::string &OrigFileName, const std::string &MimeType)
+{
+	OnFileEnd();
+
+	if ((!Params.MaxUploadSize) || (!Params.MaxTotalUploadSize))
+		return std::make_tuple(boost::filesystem::path(), false);
+
+	boost::filesystem::path TmpFilePath;
+	try
+	{
+		TmpFilePath=(Params.Root.empty() ? boost::filesystem::temp_directory_path() : Params.Root) /
+			boost::filesystem::unique_path();
+	}
+	catch (...)
+	{
+		return std::make_tuple(boost::filesystem::path(), false);
+	}
+
+	unsigned long long PreallocLength=0;
+	if ((Params.PreallocateFiles) && (MaxRemainingLength!=~0ULL) && (TotalFileSize<Params.MaxTotalUploadSize))
+		//The file can't be longer than the rest of the body.
+		PreallocLength=std::min<unsigned long long>({ MaxRemainingLength, Params.MaxUploadSize, Params.MaxTotalUploadSize-TotalFileSize });
+
+	CurrFileSize=0;
+	IsFileValid=MyStream.Open(TmpFilePath,PreallocLength,Params.DirectIO);
+	return std::make_tuple(TmpFilePath, IsFileValid);
+}
+
+bool AsyncFileUploadHelper::OnFileData(const char *Begin, const char *End)
+{
+	if (!IsFileValid)
+		return false;
+
+	uintmax_t PartSize=(uintmax_t)(End-Begin);
+	if ((CurrFileSize+=PartSize)>Params.MaxUploadSize)
+		return false;
+
+	if ((TotalFileSize+=PartSize)>Params.MaxTotalUploadSize)
+		return false;
+
+	return MyStream.Write(Begin,End);
+}
+
+void AsyncFileUploadHelper::OnFileEnd()
+{
+	if (IsFileValid)
+	{
+		MyStream.Close();
+		IsFileValid=false;
+	}
+}
+
+bool AsyncFileUploadHelper::Flush(boost::asio::yield_context &Yield)
+{
+	OnFileEnd();
+	return MyStream.Flush(Yield);
+}
+
+void AsyncFileUploadHelper::Reset()
+{
+	MyStream.Abort();
+
+	IsFileValid=false;
+	CurrFileSize=0;
+	TotalFileSize=0;
+	MaxRemainingLength=~0ULL;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/basic_waitable_timer.hpp>
+#include <boost/filesystem.hpp>
+
+#include "BuildConfig.h"
+#include "FileUploadConfig.h"
+#include "QueryParams.h"
+
+namespace HTTP
+{
+
+/**Writes files on a pool of dedicated threads, so the I/O threads aren't blocked by slow disks. The files are written
+through Stream objects: the operations of a stream are executed in order, but different streams are written in
+parallel. The writer can be shared by every connection of a server (see Config::FileUpload::Writer).*/
+class AsyncFileWriter
+{
+public:
+	/**@param ThreadCount The number of writer threads.*/
+	AsyncFileWriter(unsigned int ThreadCount=BuildConfig::UploadWriterThreadCount);
+	/**Waits for the writer threads to finish the queued operations.*/
+	~AsyncFileWriter();
+
+	AsyncFileWriter(const AsyncFileWriter &)=delete;
+	AsyncFileWriter &operator=(const AsyncFileWriter &)=delete;
+
+private:
+	struct Operation;
+
+public:
+
+	/**A sequence of files, which are written one after the other. The data is copied into a queue, and written by
+	the writer threads. The methods of this class must be called on the strand passed to the constructor.
+	If an operation fails, the rest of the stream's queued operations are dropped, and every later call fails, until
+	Abort() is called.*/
+	class Stream
+	{
+	public:
+		Stream(AsyncFileWriter &Owner, const boost::asio::strand<boost::asio::io_context::executor_type> &Strand);
+		/**Drops the queued operations (see Abort()).*/
+		~Stream();
+
+		Stream(const Stream &)=delete;
+		Stream &operator=(const Stream &)=delete;
+
+		/**Queues creating a new file. The previous file must be closed.
+		@param PreallocLength If not 0, the disk space for the file is allocated up to this length (where supported).
+			The file is truncated to it's actual length, when it's closed.
+		@param IsDirect If true, the file is written bypassing the page cache (O_DIRECT, where supported).*/
+		bool Open(const boost::filesystem::path &Path, unsigned long long PreallocLength, bool IsDirect);
+		bool Write(const char *Begin, const char *End);
+		/**Queues closing the current file. Does nothing, if there's no open file.*/
+		void Close();
+		/**Queues deleting a file, which was written by this stream. It's executed even if the stream failed or it was
+		aborted, as the operations creating the file might still be queued.*/
+		void Delete(const boost::filesystem::path &Path);
+
+		/**@return True, if the queued operations (with their data) use more memory than
+			BuildConfig::UploadWriteQueueLength.*/
+		bool IsFull();
+		/**Waits until the memory used by the queued operations falls below BuildConfig::UploadWriteQueueLength.
+		@return False, if an operation failed.*/
+		bool WaitForSpace(boost::asio::yield_context &Yield);
+		/**Waits until every queued operation is finished.
+		@return False, if an operation failed.*/
+		bool Flush(boost::asio::yield_context &Yield);
+		/**Drops the queued operations, and clears the failed state. The file which is currently written is closed and
+		deleted by the writer thread. The stream can be reused right away.*/
+		void Abort();
+
+	private:
+		friend class AsyncFileWriter;
+		struct State;
+
+		AsyncFileWriter &Owner;
+		std::shared_ptr<State> MyState;
+		boost::asio::basic_waitable_timer<std::chrono::steady_clock> WakeTim; //Cancelled by the writer threads, to resume a waiting coroutine.
+		bool IsFileOpen; //True, if a file was opened, and it's closing isn't queued yet.
+
+		bool Wait(bool IsFlush, boost::asio::yield_context &Yield);
+		/**Adds an operation to the queue, and schedules the stream, if needed. MyState->Mtx must be locked.
+		@return True, if the stream must be passed to AsyncFileWriter::Schedule(), after unlocking the mutex.*/
+		bool Push(Operation &&NewOp);
+	};
+
+private:
+	struct OpenFile;
+
+	std::mutex QueueMtx;
+	std::condition_variable QueueCV;
+	std::deque<std::shared_ptr<Stream::State>> ReadyQ; //The streams with queued operations, which aren't processed yet.
+	bool IsStopping;
+
+	std::vector<std::thread> ThreadA;
+
+	void Schedule(const std::shared_ptr<Stream::State> &Target);
+	void ThreadFunc();
+	/**Executes the next queued operation of the stream.
+	@return True, if the stream has more queued operations.*/
+	bool Process(Stream::State &Target);
+};
+
+/**File upload handler, which saves the uploaded files into the same directory as QueryParams' default handler, but
+writes them with an AsyncFileWriter. The connection pauses reading the body, while too much data is queued (see
+WaitForSpace()), and waits for the files to be written, before creating the response (see Flush()).*/
+class AsyncFileUploadHelper : public QueryParams::IFileUpdloadHelper
+{
+public:
+	/**@param Params The upload parameters. Params.Writer must be set.*/
+	AsyncFileUploadHelper(const Config::FileUpload &Params, const boost::asio::strand<boost::asio::io_context::executor_type> &Strand);
+
+	virtual std::tuple<boost::filesystem::path, bool> OnNewFile(const std::string &Name, const std::string &OrigFileName, const std::string &MimeType) override;
+	virtual bool OnFileData(const char *Begin, const char *End) override;
+	virtual void OnFileEnd() override;
+	virtual void OnFileReplaced(const boost::filesystem::path &Path) override { MyStream.Delete(Path); }
+
+	/**Sets the maximum length of the rest of the body. The space of the next file is preallocated up to this length,
+	if Config::FileUpload::PreallocateFiles is set.
+	@param MaxLength The maximum length, or ~0, if it's unknown.*/
+	inline void SetMaxRemainingLength(unsigned long long MaxLength) { MaxRemainingLength=MaxLength; }
+
+	/**Waits while too much data is queued. Called between the parts of the body.*/
+	inline bool WaitForSpace(boost::asio::yield_context &Yield) { return (!MyStream.IsFull()) || (MyStream.WaitForSpace(Yield)); }
+	/**Closes the current file, and waits until every file is written. Called after the whole body was parsed.*/
+	bool Flush(boost::asio::yield_context &Yield);
+	/**Drops the queued data (so the uploaded files can be deleted), and prepares the handler for the next request.*/
+	void Reset();
+
+private:
+	Config::FileUpload Params;
+	AsyncFileWriter::Stream MyStream;
+
+	bool IsFileValid;
+	uintmax_t CurrFileSize, TotalFileSize;
+	unsigned long long MaxRemainingLength;
+};
+
+}; //HTTP
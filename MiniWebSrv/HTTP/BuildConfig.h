@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+
 namespace HTTP
 {
 
@@ -8,6 +10,60 @@ namespace BuildConfig
 	const unsigned int ReadBuffSize = 16*1024;
 	const unsigned int WriteBuffSize = 24*1024;
 	const unsigned int WriteQueueInitSize = 8;
+	/**Maximum number of buffers sent with one gather write. The responses of pipelined requests are queued until either
+	this many buffers or WriteBuffSize bytes are pending.*/
+	const unsigned int MaxGatherWriteCount = 64;
+	/**Maximum length of a chunk size line (with it's extensions), or a trailer line in chunked request bodies.*/
+	const unsigned int MaxChunkLineLength = 1024;
+
+	/**Minimum length of the responses, which are sent directly from a file with sendfile() (where supported). Smaller
+	responses are copied through the write buffer, so they can be sent together with other pipelined responses.*/
+	const unsigned long long SendFileMinLength = 64*1024;
+	/**Maximum number of bytes sent with one sendfile() call.*/
+	const unsigned int SendFileChunkSize = 1024*1024;
+
+	/**Maximum number of resolved resources (path, size, modification time, MIME type) cached by each FS response source.*/
+	const unsigned int FSMetaCacheSize = 4096;
+	/**Maximum length of the files, which are kept in the (optional) content cache of the FS response sources. Larger
+	files are read from the disk (or sent with sendfile()) for every request.*/
+	const unsigned long long FSContentCacheMaxFileSize = 64*1024;
+	/**If true, the FS response sources look for precompressed siblings of the requested files (foo.js.br, foo.js.zst,
+	foo.js.gz), and send them instead of the file to the clients which accept their content coding.*/
+	const bool FSServePrecompressed = true;
+
+	/**Default maximum total length of the decompressed entries, which are cached by each Zip response source for clients
+	without gzip support.*/
+	const unsigned long long ZipInflateCacheSize = 16*1024*1024;
+	/**Maximum (uncompressed) length of the zip entries, which are cached decompressed. Larger entries are decompressed for
+	every request.*/
+	const unsigned long long ZipInflateCacheMaxFileSize = 1024*1024;
+	/**A zip entry is only cached decompressed, after it was requested this many times without gzip support.*/
+	const unsigned int ZipInflateCacheMinRequestCount = 2;
+
+	/**Minimum length of the responses compressed by the Gzip response sources. Responses of unknown length are always
+	compressed.*/
+	const unsigned long long GzipMinLength = 512;
+	/**Default zlib compression level of the Gzip response sources.*/
+	const int GzipDefaultLevel = 6;
+
+	/**Default number of threads of an AsyncFileWriter.*/
+	const unsigned int UploadWriterThreadCount = 2;
+	/**Maximum memory used by the operations (with the uploaded data), which are queued for writing by an AsyncFileWriter
+	for each connection. The connection stops reading the request body, until the writer threads reduce the queue to
+	half of this.*/
+	const unsigned int UploadWriteQueueLength = 1024*1024;
+	/**Consecutive uploaded data is collected into blocks of this length (at most), before writing it. It's the size of
+	the writes of O_DIRECT files, so it must be a multiple of the disk block size.*/
+	const unsigned int UploadWriteBlockSize = 256*1024;
+
+	/**Maximum number of unused connection read/write buffer sets kept by each thread.*/
+	const unsigned int BuffPoolSize = 32;
+
+	/**Maximum number of finished connections kept for reuse by each server shard.*/
+	const unsigned int ConnPoolSize = 128;
+
+	/**Tick length of the connection timeout scheduler.*/
+	const std::chrono::steady_clock::duration TimerResolution = std::chrono::milliseconds(100);
 };
 
 namespace WebSocket
@@ -19,6 +75,7 @@ namespace Config
 	const unsigned int WriteBuffSize = 4*1024;
 	const unsigned int WriteQueueInitSize = 8;
 
+	const unsigned int StepInterval = 1; //IMsgHandler::OnStep() is called with this period.
 	const unsigned int MaxSilentTime = 1*60*60;
 	const unsigned int MaxPingInterval = 30;//5*60;
 	const unsigned int MaxFrameSize = 16*1024*1024;
@@ -5,6 +5,7 @@ const char *HTTP::GetResponseName(RESPONSECODE Code)
 	switch (Code)
 	{
 	case RC_OK: return "OK";
+	case RC_PARTIALCONTENT: return "PartialContent";
 	case RC_MOVEPERMANENT: return "MovedPermanently";
 	case RC_FOUND: return "Found";
 	case RC_SEEOTHER: return "SeeOther";
@@ -12,6 +13,8 @@ const char *HTTP::GetResponseName(RESPONSECODE Code)
 	case RC_UNAUTHORIZED: return "Unauthorized";
 	case RC_FORBIDDEN: return "YouShallNotPass";
 	case RC_NOTFOUND: return "NotFound";
+	case RC_PAYLOADTOOLARGE: return "PayloadTooLarge";
+	case RC_RANGENOTSATISFIABLE: return "RangeNotSatisfiable";
 	case RC_SERVERERROR: return "ServerError";
 	default: return "Whatever";
 	}
@@ -23,6 +23,7 @@ enum RESPONSECODE
 {
 	RC_SWITCH_PROT  = 101,
 	RC_OK           = 200,
+	RC_PARTIALCONTENT = 206,
 	RC_MOVEPERMANENT= 301,
 	RC_FOUND        = 302,
 	RC_SEEOTHER     = 303,
@@ -32,6 +33,8 @@ enum RESPONSECODE
 	RC_UNAUTHORIZED = 401,
 	RC_FORBIDDEN    = 403,
 	RC_NOTFOUND     = 404,
+	RC_PAYLOADTOOLARGE = 413,
+	RC_RANGENOTSATISFIABLE = 416,
 	RC_SERVERERROR  = 500,
 };
 
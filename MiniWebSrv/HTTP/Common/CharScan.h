@@ -0,0 +1,142 @@
+#pragma once
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define UD_CHARSCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP>=2))
+#include <emmintrin.h>
+#define UD_CHARSCAN_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace UD
+{
+
+/**Byte scanning helpers for the protocol parsers. Uses AVX2 or SSE2 (selected at compile time) to process 32 or 16
+bytes at once, with a scalar fallback for other platforms and for the tail of the buffers. Data after the end of
+the buffers is never read.*/
+namespace CharScan
+{
+
+namespace detail
+{
+
+inline unsigned int CountTrailingZeros(unsigned int Val)
+{
+#ifdef _MSC_VER
+	unsigned long RetVal;
+	_BitScanForward(&RetVal,Val);
+	return RetVal;
+#else
+	return __builtin_ctz(Val);
+#endif
+}
+
+#if defined(UD_CHARSCAN_AVX2)
+typedef __m256i VecType;
+static const unsigned int VecSize = 32;
+
+inline VecType Load(const unsigned char *Src) { return _mm256_loadu_si256((const __m256i *)Src); }
+inline void Store(unsigned char *Target, VecType Val) { _mm256_storeu_si256((__m256i *)Target, Val); }
+inline VecType Splat(char Val) { return _mm256_set1_epi8(Val); }
+inline unsigned int MatchMask(VecType Data, VecType Val) { return (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(Data,Val)); }
+inline VecType Or(VecType Op1, VecType Op2) { return _mm256_or_si256(Op1,Op2); }
+inline VecType And(VecType Op1, VecType Op2) { return _mm256_and_si256(Op1,Op2); }
+inline VecType Add(VecType Op1, VecType Op2) { return _mm256_add_epi8(Op1,Op2); }
+inline VecType Less(VecType Op1, VecType Op2) { return _mm256_cmpgt_epi8(Op2,Op1); }
+#elif defined(UD_CHARSCAN_SSE2)
+typedef __m128i VecType;
+static const unsigned int VecSize = 16;
+
+inline VecType Load(const unsigned char *Src) { return _mm_loadu_si128((const __m128i *)Src); }
+inline void Store(unsigned char *Target, VecType Val) { _mm_storeu_si128((__m128i *)Target, Val); }
+inline VecType Splat(char Val) { return _mm_set1_epi8(Val); }
+inline unsigned int MatchMask(VecType Data, VecType Val) { return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(Data,Val)); }
+inline VecType Or(VecType Op1, VecType Op2) { return _mm_or_si128(Op1,Op2); }
+inline VecType And(VecType Op1, VecType Op2) { return _mm_and_si128(Op1,Op2); }
+inline VecType Add(VecType Op1, VecType Op2) { return _mm_add_epi8(Op1,Op2); }
+inline VecType Less(VecType Op1, VecType Op2) { return _mm_cmplt_epi8(Op1,Op2); }
+#endif
+
+}; //detail
+
+/**@return The first byte in [Begin, End) equal to Val, or End.*/
+inline const unsigned char *Find(const unsigned char *Begin, const unsigned char *End, unsigned char Val)
+{
+#if defined(UD_CHARSCAN_AVX2) || defined(UD_CHARSCAN_SSE2)
+	using namespace detail;
+
+	const VecType ValV=Splat((char)Val);
+	for (; (unsigned int)(End-Begin)>=VecSize; Begin+=VecSize)
+	{
+		if (unsigned int Mask=MatchMask(Load(Begin),ValV))
+			return Begin + CountTrailingZeros(Mask);
+	}
+#endif
+
+	for (; Begin!=End; ++Begin)
+		if (*Begin==Val)
+			return Begin;
+
+	return End;
+}
+
+/**@return The first byte in [Begin, End) equal to Val1 or Val2, or End.*/
+inline const unsigned char *FindEither(const unsigned char *Begin, const unsigned char *End, unsigned char Val1, unsigned char Val2)
+{
+#if defined(UD_CHARSCAN_AVX2) || defined(UD_CHARSCAN_SSE2)
+	using namespace detail;
+
+	const VecType Val1V=Splat((char)Val1), Val2V=Splat((char)Val2);
+	for (; (unsigned int)(End-Begin)>=VecSize; Begin+=VecSize)
+	{
+		VecType Data=Load(Begin);
+		if (unsigned int Mask=MatchMask(Data,Val1V) | MatchMask(Data,Val2V))
+			return Begin + CountTrailingZeros(Mask);
+	}
+#endif
+
+	for (; Begin!=End; ++Begin)
+		if ((*Begin==Val1) || (*Begin==Val2))
+			return Begin;
+
+	return End;
+}
+
+inline unsigned char *Find(unsigned char *Begin, unsigned char *End, unsigned char Val)
+{
+	return const_cast<unsigned char *>(Find((const unsigned char *)Begin,(const unsigned char *)End,Val));
+}
+
+inline unsigned char *FindEither(unsigned char *Begin, unsigned char *End, unsigned char Val1, unsigned char Val2)
+{
+	return const_cast<unsigned char *>(FindEither((const unsigned char *)Begin,(const unsigned char *)End,Val1,Val2));
+}
+
+/**Converts the ASCII uppercase letters in [Begin, End) to lowercase, in place.*/
+inline void ToLower(unsigned char *Begin, unsigned char *End)
+{
+#if defined(UD_CHARSCAN_AVX2) || defined(UD_CHARSCAN_SSE2)
+	using namespace detail;
+
+	//Shift 'A' to -128, so every uppercase letter is below -128+26 as a signed value.
+	const VecType ShiftV=Splat((char)(0x80-'A')), LimitV=Splat((char)(0x80+26)), CaseBitV=Splat(0x20);
+	for (; (unsigned int)(End-Begin)>=VecSize; Begin+=VecSize)
+	{
+		VecType Data=Load(Begin);
+		VecType UpperMask=Less(Add(Data,ShiftV),LimitV);
+		Store(Begin,Or(Data,And(UpperMask,CaseBitV)));
+	}
+#endif
+
+	for (; Begin!=End; ++Begin)
+		if ((*Begin>='A') && (*Begin<='Z'))
+			*Begin=*Begin-'A'+'a';
+}
+
+}; //CharScan
+
+}; //UD
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+//sendfile(2) can send from a file to a socket, without copying the data to user space.
+#define UD_SENDFILE_SUPPORTED
+#endif
+
+namespace UD
+{
+
+namespace FileUtils
+{
+
+#ifdef _WIN32
+typedef void *FileHandle; //HANDLE
+#else
+typedef int FileHandle;
+#endif
+
+#ifdef UD_SENDFILE_SUPPORTED
+const FileHandle InvalidFileHandle = -1;
+
+/**Opens the given file for reading.
+@return The opened file, or InvalidFileHandle on error.*/
+inline FileHandle OpenRead(const char *FileName)
+{
+	return ::open(FileName,O_RDONLY | O_CLOEXEC);
+}
+
+inline void Close(FileHandle File)
+{
+	if (File!=InvalidFileHandle)
+		::close(File);
+}
+
+/**Reads from the given position of the file, without changing the file position.
+@return The number of bytes read, or -1 on error.*/
+inline long long ReadAt(FileHandle File, unsigned long long Offset, void *Target, std::size_t Length)
+{
+	ssize_t RetVal;
+	do
+		RetVal=::pread(File,Target,Length,(off_t)Offset);
+	while ((RetVal<0) && (errno==EINTR));
+
+	return RetVal;
+}
+
+/**Sends data from a file to a socket, with sendfile(2).
+@param Offset The position of the data in the file. Advanced by the number of bytes sent.
+@return The number of bytes sent, or -1 on error (with errno set). If the socket is non-blocking, and it can't accept more
+	data, errno is EAGAIN.*/
+inline long long SendFile(int SockFD, FileHandle File, unsigned long long &Offset, std::size_t Length)
+{
+	off_t CurrOffset=(off_t)Offset;
+
+	ssize_t RetVal;
+	do
+		RetVal=::sendfile(SockFD,File,&CurrOffset,Length);
+	while ((RetVal<0) && (errno==EINTR));
+
+	if (RetVal>0)
+		Offset=(unsigned long long)CurrOffset;
+
+	return RetVal;
+}
+#endif
+
+}; //FileUtils
+
+}; //UD
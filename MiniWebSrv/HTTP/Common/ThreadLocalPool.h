@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+
+namespace UD
+{
+
+namespace Comm
+{
+
+/**Per-thread free list of default constructible objects. Objects released on one thread can be acquired on another
+thread later: the free lists only store the objects, which are currently not in use. At most MaxFreeCount objects are
+kept on every thread, the rest are deleted. The released objects are not reset: the caller should do that.*/
+template<class T, unsigned int MaxFreeCount>
+class ThreadLocalPool
+{
+public:
+	static T *Acquire()
+	{
+		FreeList &CurrLst=GetFreeList();
+		if (!CurrLst.ObjA.empty())
+		{
+			T *RetVal=CurrLst.ObjA.back();
+			CurrLst.ObjA.pop_back();
+			return RetVal;
+		}
+		else
+			return new T();
+	}
+
+	static void Release(T *Obj)
+	{
+		FreeList &CurrLst=GetFreeList();
+		if (CurrLst.ObjA.size()<MaxFreeCount)
+			CurrLst.ObjA.push_back(Obj);
+		else
+			delete Obj;
+	}
+
+private:
+	struct FreeList
+	{
+		~FreeList()
+		{
+			for (T *CurrObj : ObjA)
+				delete CurrObj;
+		}
+
+		std::vector<T *> ObjA;
+	};
+
+	static FreeList &GetFreeList()
+	{
+		thread_local FreeList ThreadLst;
+		return ThreadLst;
+	}
+};
+
+}; //Comm
+
+}; //UD
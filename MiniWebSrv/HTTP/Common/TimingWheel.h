@@ -0,0 +1,233 @@
+#pragma once
+
+namespace UD
+{
+
+namespace Comm
+{
+
+template<unsigned int LevelBits, unsigned int LevelCount>
+class TimingWheel;
+
+/**Base class of the objects which can be scheduled with a TimingWheel. The node contains the intrusive list links, so
+scheduling and cancelling never allocates memory.*/
+class TimingWheelNode
+{
+public:
+	inline TimingWheelNode() : Prev(nullptr), Next(nullptr), Expiry(0) { }
+
+	inline bool IsScheduled() const { return Next!=nullptr; }
+
+private:
+	template<unsigned int LevelBits, unsigned int LevelCount> friend class TimingWheel;
+
+	TimingWheelNode *Prev, *Next;
+	unsigned long long Expiry; //Absolute tick.
+};
+
+/**Hierarchical timing wheel. Level 0 contains one slot for every tick, and every other level contains slots which
+are 2^LevelBits times wider than the ones on the previous level. When the wheel advances to the beginning of a slot on a
+higher level, the nodes in that slot are redistributed ("cascaded") to the lower levels. Scheduling and cancelling
+is O(1), and advancing by one tick only touches the nodes which expire in that tick (and the nodes which are
+cascaded).
+Nodes which would expire later than the range of the wheel are clamped to its last tick.
+Objects of this class are not thread-safe.*/
+template<unsigned int LevelBits=6, unsigned int LevelCount=4>
+class TimingWheel
+{
+public:
+	static const unsigned int SlotCount = 1 << LevelBits;
+	static const unsigned long long MaxDelay = (1ULL << (LevelBits*LevelCount)) - 1;
+
+	inline TimingWheel() : CurrTick(0), NodeCount(0)
+	{
+		for (unsigned int LevelI=0; LevelI!=LevelCount; ++LevelI)
+			for (unsigned int SlotI=0; SlotI!=SlotCount; ++SlotI)
+				InitList(SlotA[LevelI][SlotI]);
+	}
+	TimingWheel(const TimingWheel &)=delete;
+	TimingWheel &operator=(const TimingWheel &)=delete;
+
+	inline unsigned long long GetTick() const { return CurrTick; }
+	inline unsigned int GetCount() const { return NodeCount; }
+	inline bool IsEmpty() const { return NodeCount==0; }
+
+	/**Schedules the given node to expire at the given tick. If the node is already scheduled, it will be rescheduled.
+	@param Tick Absolute tick. If it's not later than the current tick, the node will expire in the next tick.*/
+	void Schedule(TimingWheelNode *Node, unsigned long long Tick)
+	{
+		if (Node->IsScheduled())
+			Cancel(Node);
+
+		if (Tick<=CurrTick)
+			Tick=CurrTick+1;
+		else if (Tick-CurrTick>MaxDelay)
+			Tick=CurrTick+MaxDelay;
+
+		Node->Expiry=Tick;
+		Insert(Node);
+		++NodeCount;
+	}
+
+	void Cancel(TimingWheelNode *Node)
+	{
+		if (Node->IsScheduled())
+		{
+			Unlink(Node);
+			--NodeCount;
+		}
+	}
+
+	/**Advances the wheel to the given tick, calling Func(TimingWheelNode *) for every expired node. The nodes are
+	unscheduled before the call, and Func is allowed to reschedule or cancel any node.*/
+	template<class FuncType>
+	void Advance(unsigned long long NewTick, FuncType Func)
+	{
+		while (CurrTick<NewTick)
+		{
+			++CurrTick;
+
+			unsigned int SlotI=(unsigned int)(CurrTick & (SlotCount-1));
+			if (!SlotI)
+			{
+				//Cascade from the higher levels, until a level is found which is not at the beginning of a new round.
+				for (unsigned int LevelI=1; LevelI!=LevelCount; ++LevelI)
+					if (Cascade(LevelI))
+						break;
+			}
+
+			if (!NodeCount)
+			{
+				//Nothing is scheduled, so nothing has to be cascaded either: skip to the target tick.
+				CurrTick=NewTick;
+				break;
+			}
+
+			TimingWheelNode ExpiredLst;
+			MoveList(SlotA[0][SlotI], ExpiredLst);
+			while (ExpiredLst.Next!=&ExpiredLst)
+			{
+				TimingWheelNode *CurrNode=ExpiredLst.Next;
+				Unlink(CurrNode);
+				--NodeCount;
+				Func(CurrNode);
+			}
+		}
+	}
+
+	/**@return A tick, which is not later than the first tick when any node expires (or a cascade is necessary). The
+		wheel can be advanced to this tick without missing anything. If the wheel is empty, the current tick is returned.*/
+	unsigned long long GetNextTick() const
+	{
+		if (!NodeCount)
+			return CurrTick;
+
+		unsigned int CurrSlotI=(unsigned int)(CurrTick & (SlotCount-1));
+		for (unsigned int SlotI=CurrSlotI+1; SlotI!=SlotCount; ++SlotI)
+			if (SlotA[0][SlotI].Next!=&SlotA[0][SlotI])
+				return CurrTick + (SlotI-CurrSlotI);
+
+		//Nothing on level 0 in this round: wake up at the next cascade.
+		return CurrTick + (SlotCount-CurrSlotI);
+	}
+
+	/**Calls Func(TimingWheelNode *) for every scheduled node. Func must not modify the wheel.*/
+	template<class FuncType>
+	void ForEach(FuncType Func)
+	{
+		for (unsigned int LevelI=0; LevelI!=LevelCount; ++LevelI)
+			for (unsigned int SlotI=0; SlotI!=SlotCount; ++SlotI)
+			{
+				TimingWheelNode &CurrLst=SlotA[LevelI][SlotI];
+				for (TimingWheelNode *CurrNode=CurrLst.Next; CurrNode!=&CurrLst; CurrNode=CurrNode->Next)
+					Func(CurrNode);
+			}
+	}
+
+	/**Unschedules every node, without calling anything on them.*/
+	void Clear()
+	{
+		for (unsigned int LevelI=0; LevelI!=LevelCount; ++LevelI)
+			for (unsigned int SlotI=0; SlotI!=SlotCount; ++SlotI)
+			{
+				TimingWheelNode &CurrLst=SlotA[LevelI][SlotI];
+				while (CurrLst.Next!=&CurrLst)
+					Unlink(CurrLst.Next);
+			}
+
+		NodeCount=0;
+	}
+
+private:
+	TimingWheelNode SlotA[LevelCount][SlotCount]; //Every slot is a circular list, with the slot itself as the sentinel.
+	unsigned long long CurrTick;
+	unsigned int NodeCount;
+
+	void Insert(TimingWheelNode *Node)
+	{
+		unsigned long long Delay=Node->Expiry-CurrTick;
+
+		unsigned int LevelI=0;
+		while ((LevelI!=LevelCount-1) && (Delay>>(LevelBits*(LevelI+1))))
+			++LevelI;
+
+		unsigned int SlotI=(unsigned int)((Node->Expiry>>(LevelBits*LevelI)) & (SlotCount-1));
+		TimingWheelNode &TargetLst=SlotA[LevelI][SlotI];
+
+		Node->Prev=TargetLst.Prev;
+		Node->Next=&TargetLst;
+		TargetLst.Prev->Next=Node;
+		TargetLst.Prev=Node;
+	}
+
+	/**Redistributes the current slot of the given level to the lower levels.
+	@return True, if the level is not at the beginning of a new round.*/
+	bool Cascade(unsigned int LevelI)
+	{
+		unsigned int SlotI=(unsigned int)((CurrTick>>(LevelBits*LevelI)) & (SlotCount-1));
+
+		TimingWheelNode CascadeLst;
+		MoveList(SlotA[LevelI][SlotI], CascadeLst);
+		while (CascadeLst.Next!=&CascadeLst)
+		{
+			TimingWheelNode *CurrNode=CascadeLst.Next;
+			Unlink(CurrNode);
+			Insert(CurrNode);
+		}
+
+		return SlotI!=0;
+	}
+
+	static inline void InitList(TimingWheelNode &Target)
+	{
+		Target.Prev=&Target;
+		Target.Next=&Target;
+	}
+
+	static inline void Unlink(TimingWheelNode *Node)
+	{
+		Node->Prev->Next=Node->Next;
+		Node->Next->Prev=Node->Prev;
+		Node->Prev=nullptr;
+		Node->Next=nullptr;
+	}
+
+	/**Moves every node of Source into the (uninitialized) Target list.*/
+	static inline void MoveList(TimingWheelNode &Source, TimingWheelNode &Target)
+	{
+		if (Source.Next!=&Source)
+		{
+			Target.Next=Source.Next;
+			Target.Prev=Source.Prev;
+			Target.Next->Prev=&Target;
+			Target.Prev->Next=&Target;
+			InitList(Source);
+		}
+		else
+			InitList(Target);
+	}
+};
+
+}; //Comm
+
+}; //UD
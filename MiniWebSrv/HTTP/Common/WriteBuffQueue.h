@@ -1,9 +1,13 @@
 #pragma once
 
 #include <memory.h>
+#include <deque>
 #include <list>
+#include <memory>
+#include <vector>
 
 #include <boost/circular_buffer.hpp>
+#include <boost/asio/buffer.hpp>
 
 #include "BinUtils.h"
 
@@ -26,7 +30,11 @@ If a write doesn't fit at either end of the FIFO buffer, then a new memory
 buffer is allocated, and the write enqueued with it. Buffers allocated this way
 are never released explicitly, only in the destructor. However, a buffer can
 be reallocated internally, if a given write doesn't fit into any previously
-allocated buffer.*/
+allocated buffer.
+Every buffer waiting to be written can be retrieved at once with PopAll(), so
+they can be sent with one gather write system call.
+Memory owned by the caller can also be enqueued without copying, with
+PushExternal().*/
 template<unsigned int StaticWriteBuffSize, unsigned int InitQueueSize>
 class WriteBuffQueue
 {
@@ -34,6 +42,7 @@ public:
 	inline WriteBuffQueue() : FIFOFreeBegin(WriteBuff), FIFOUsedBegin(WriteBuff),
 		LastAllocLength(0), OutBuffA(InitQueueSize), FirstPendingI(0)
 	{
+		GatherA.reserve(InitQueueSize);
 	}
 	inline ~WriteBuffQueue()
 	{
@@ -44,7 +53,7 @@ public:
 		//Delete the unsent, dynamically allocated buffers, too.
 		for (typename boost::circular_buffer<Buffer>::iterator NowI=OutBuffA.begin(), EndI=OutBuffA.end(); NowI!=EndI; ++NowI)
 		{
-			if (!IsStaticBuffer(*NowI))
+			if ((!IsStaticBuffer(*NowI)) && (!IsExternalBuffer(*NowI)))
 				delete[] NowI->Buff;
 		}
 	}
@@ -69,7 +78,7 @@ public:
 			//Delete the unsent, dynamically allocated buffers, too.
 			for (typename boost::circular_buffer<Buffer>::iterator NowI=OutBuffA.begin(), EndI=OutBuffA.end(); NowI!=EndI; ++NowI)
 			{
-				if (!IsStaticBuffer(*NowI))
+				if ((!IsStaticBuffer(*NowI)) && (!IsExternalBuffer(*NowI)))
 					delete[] NowI->Buff;
 			}
 		}
@@ -78,12 +87,14 @@ public:
 			//Retain the previously allocated, dynamic buffers.
 			for (typename boost::circular_buffer<Buffer>::iterator NowI=OutBuffA.begin(), EndI=OutBuffA.end(); NowI!=EndI; ++NowI)
 			{
-				if (!IsStaticBuffer(*NowI))
+				if ((!IsStaticBuffer(*NowI)) && (!IsExternalBuffer(*NowI)))
 					FreeBuffList.push_back(DynBuffer(NowI->Buff,NowI->AllocLength));
 			}
 		}
 
 		OutBuffA.clear();
+		ExternalOwnerQ.clear();
+		GatherA.clear();
 
 		FirstPendingI=0;
 	}
@@ -240,6 +251,25 @@ public:
 		Commit();
 	}
 
+	/**Enqueues a buffer owned by the caller, without copying it's contents.
+	Like Push(), it can't be called while an allocated buffer is waiting for Commit().
+	@param Owner Kept until the buffer is released, so Src stays valid while it's
+		queued.*/
+	void PushExternal(const unsigned char *Src, unsigned int Length, std::shared_ptr<const void> Owner)
+	{
+		if (!Length)
+			return;
+
+		Buffer NewBuff((unsigned char *)Src,Length,0,typename Buffer::AllocatedStateOption());
+		NewBuff.State=BS_PENDING;
+		if (!OutBuffA.full())
+			OutBuffA.push_back(NewBuff);
+		else
+			OutBuffA.resize(OutBuffA.size()+1,NewBuff);
+
+		ExternalOwnerQ.push_back(std::move(Owner));
+	}
+
 	/**Gets the next buffer to write.
 	@return The buffer to write.*/
 	const unsigned char *Pop(unsigned int &OutLength)
@@ -260,6 +290,71 @@ public:
 			return NULL;
 		}
 	}
+	/**Gets every buffer to write: the ones already returned by Pop() or PopAll(), but not released yet, and the pending
+	ones. Partially written buffers are only returned from the first unwritten byte.
+	@return The buffers to write, as a ConstBufferSequence. Only valid until the next call of a non-const method.*/
+	const std::vector<boost::asio::const_buffer> &PopAll()
+	{
+		GatherA.clear();
+		for (unsigned int BuffI=0, BuffCount=(unsigned int)OutBuffA.size(); BuffI!=BuffCount; ++BuffI)
+		{
+			Buffer &CurrBuff=OutBuffA[BuffI];
+			if (CurrBuff.State==BS_PENDING)
+			{
+				CurrBuff.State=BS_WRITING;
+				FirstPendingI++;
+			}
+			else if (CurrBuff.State!=BS_WRITING)
+				break;
+
+			GatherA.push_back(boost::asio::const_buffer(CurrBuff.Buff + CurrBuff.SentLength, CurrBuff.Length - CurrBuff.SentLength));
+		}
+
+		return GatherA;
+	}
+
+	/**@return The number of committed buffers, which weren't returned by Pop() yet.*/
+	unsigned int GetPendingCount() const
+	{
+		unsigned int RetVal=(unsigned int)OutBuffA.size()-FirstPendingI;
+		if ((RetVal) && (OutBuffA.back().State==BS_ALLOCATED))
+			--RetVal;
+
+		return RetVal;
+	}
+	/**@return The total length of the committed buffers, which weren't returned by Pop() yet.*/
+	unsigned int GetPendingLength() const
+	{
+		unsigned int RetVal=0;
+		for (unsigned int BuffI=FirstPendingI, BuffCount=(unsigned int)OutBuffA.size(); BuffI!=BuffCount; ++BuffI)
+			if (OutBuffA[BuffI].State==BS_PENDING)
+				RetVal+=OutBuffA[BuffI].Length;
+
+		return RetVal;
+	}
+	/**Releases the given number of written bytes, from the beginning of the
+	buffers returned by Pop() or PopAll(). Fully written buffers are released,
+	while a partially written buffer is kept, and only it's remaining part will
+	be returned by the next PopAll() call.*/
+	void Release(std::size_t Length)
+	{
+		while ((Length) && (!OutBuffA.empty()))
+		{
+			Buffer &CurrBuff=OutBuffA.front();
+			if (CurrBuff.State!=BS_WRITING)
+				break;
+
+			unsigned int RemLength=CurrBuff.Length - CurrBuff.SentLength;
+			if (Length<RemLength)
+			{
+				CurrBuff.SentLength+=(unsigned int)Length;
+				break;
+			}
+
+			Length-=RemLength;
+			Release();
+		}
+	}
 	/**Releases the first buffer returned by Pop(). After this call, the storage
 	space used by this buffer can be reused.*/
 	void Release()
@@ -291,6 +386,9 @@ public:
 				FIFOFreeBegin=WriteBuff;
 			}
 		}
+		else if (IsExternalBuffer(CurrBuff))
+			//External buffers are released in the order they were pushed.
+			ExternalOwnerQ.pop_front();
 		else
 			//This is a dynamic buffer: keep it separately.
 			FreeBuffList.push_back(DynBuffer(CurrBuff.Buff,CurrBuff.AllocLength));
@@ -322,11 +420,12 @@ protected:
 
 		inline Buffer() { }
 		inline Buffer(unsigned char *NewBuff, unsigned int NewLen, unsigned int NewAllocLen, AllocatedStateOption) :
-			Buff(NewBuff), Length(NewLen), AllocLength(NewAllocLen), State(BS_ALLOCATED)
+			Buff(NewBuff), Length(NewLen), AllocLength(NewAllocLen), SentLength(0), State(BS_ALLOCATED)
 		{ }
 
 		unsigned char *Buff;
-		unsigned int Length, AllocLength;
+		unsigned int Length, AllocLength; //AllocLength is 0 for external buffers.
+		unsigned int SentLength; //Number of bytes already written, while in BS_WRITING state.
 		BUFFERSTATE State;
 	};
 
@@ -338,12 +437,19 @@ protected:
 	boost::circular_buffer<Buffer> OutBuffA; //Enqueued buffers.
 	unsigned int FirstPendingI; //Index of the first pending buffer.
 	std::list<DynBuffer> FreeBuffList; //Free, dynamically allocated buffers.
+	std::vector<boost::asio::const_buffer> GatherA; //The result of the last PopAll() call.
+	std::deque<std::shared_ptr<const void>> ExternalOwnerQ; //Owners of the enqueued external buffers, in queue order.
 
 	bool IsStaticBuffer(const Buffer &Src) const
 	{
 		return (Src.Buff>=WriteBuff) && (Src.Buff<(WriteBuff + sizeof(WriteBuff)));
 	}
 
+	inline bool IsExternalBuffer(const Buffer &Src) const
+	{
+		return !Src.AllocLength;
+	}
+
 	void GetContinousFreeFIFOLength(unsigned int &OutFromBegin, unsigned int &OutFromFIFOBegin) const
 	{
 		if (FIFOFreeBegin>=FIFOUsedBegin)
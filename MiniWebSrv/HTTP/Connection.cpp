@@ -1,9 +1,11 @@
 #include "Connection.h"
 
 #include "Common/TimeUtils.h"
+#include "Common/CharScan.h"
 
 #include "IRespSource.h"
 #include "IServerLog.h"
+#include "AsyncFileWriter.h"
 
 #include "RespSources/CommonErrorRespSource.h"
 #include "RespSources/CORSPreflightRespSource.h"
@@ -13,14 +15,19 @@ using namespace HTTP;
 Connection::Connection(boost::asio::io_context &MyIOS, RespSource::CommonError *NewErrorRS, RespSource::CORSPreflight *NewCorsPFRS, const char *NewServerName,
 	Config::Connection Conf, Config::FileUpload FUConf) :
 	ConnectionBase(MyIOS),
-	MyIOS(MyIOS), MyStrand(MyIOS.get_executor()), SilentTime(0), IsDeletable(true),
+	MyIOS(MyIOS), MyStrand(MyIOS.get_executor()), LastActiveTime(0), RunStates(0),
 	CurrQuery(FUConf),
 	ContentLength(0), ContentBuff(nullptr), ContentEndBuff(nullptr),
-	ServerName(NewServerName), MyRespSource(nullptr), MyLog(nullptr), ErrorRS(NewErrorRS), CorsPFRS(NewCorsPFRS),
-	PostHeaderBuff(nullptr), PostHeaderBuffEnd(nullptr),
-	NextConn(nullptr), Conf(Conf)
+	ContentRemLength(0), IsContentChunked(false), ChunkState(CS_SIZE), BodyResp(nullptr), BodyRespCORS(false), IsContentLeft(false),
+	ServerName(NewServerName), MyLog(nullptr), ErrorRS(NewErrorRS), CorsPFRS(NewCorsPFRS),
+	PostHeaderBuff(nullptr), PostHeaderBuffEnd(nullptr), Buffs(nullptr),
+	NextConn(nullptr), Conf(Conf), FUConf(FUConf)
 {
-
+	if (FUConf.Writer)
+	{
+		UploadHelper.reset(new AsyncFileUploadHelper(FUConf,MyStrand));
+		CurrQuery=QueryParams(UploadHelper.get());
+	}
 }
 
 Connection::~Connection()
@@ -28,82 +35,203 @@ Connection::~Connection()
 	if (MyLog)
 		MyLog->OnConnectionFinished(this);
 
+	delete BodyResp;
 	delete[] PostHeaderBuff;
+	ReleaseBuffers();
 
+	if (UploadHelper)
+		//The queued writes mustn't recreate the deleted files.
+		UploadHelper->Reset();
 	CurrQuery.DeleteUploadedFiles();
 
 	delete NextConn;
 }
 
-void Connection::Start(IRespSource *NewRespSource, IServerLog *NewLog)
+void Connection::Start(IServerLog *NewLog)
 {
-	IsDeletable=false;
+	RunStates=RUNSTATE_RUNNING;
+	MarkActive();
 
-	MyRespSource=NewRespSource;
 	MyLog=NewLog;
 	boost::asio::spawn(MyStrand, boost::bind(&Connection::ProtocolHandler, this, boost::placeholders::_1), boost::asio::detached);
 }
 
+bool Connection::Reset()
+{
+	if (MyLog)
+	{
+		MyLog->OnConnectionFinished(this);
+		MyLog=nullptr;
+	}
+
+	try { MySock.close(); }
+	catch (...) { }
+
+	RunStates=0;
+	ResponseCount=0;
+
+	if (UploadHelper)
+		UploadHelper->Reset();
+	CurrQuery.DeleteUploadedFiles();
+	ResetRequestData();
+	ContentBuff=nullptr;
+	ContentEndBuff=nullptr;
+
+	ReleaseBuffers();
+
+	delete NextConn;
+	NextConn=nullptr;
+
+	return true;
+}
+
 void Connection::Stop()
+{
+	if (RunStates.load()!=0)
+		RequestClose();
+	else
+	{
+		try { MySock.close(); }
+		catch (...) { }
+	}
+}
+
+std::chrono::steady_clock::duration Connection::OnTimer(std::chrono::steady_clock::time_point Now)
+{
+	std::chrono::steady_clock::time_point Deadline=
+		std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(LastActiveTime.load(std::memory_order_relaxed))) + Conf.MaxSilentTime;
+
+	if (Deadline>Now)
+		return Deadline-Now;
+	else
+	{
+		//The manager will be notified when the close finishes. Until then, check again later.
+		RequestClose();
+		return Conf.MaxSilentTime;
+	}
+}
+
+void Connection::RequestClose()
+{
+	//The socket can only be closed on MyStrand, as the protocol handler might be running on another thread.
+	unsigned int ExpectedStates=RUNSTATE_RUNNING;
+	if (RunStates.compare_exchange_strong(ExpectedStates, RUNSTATE_RUNNING | RUNSTATE_CLOSEPENDING))
+		boost::asio::post(MyStrand, boost::bind(&Connection::OnCloseReq, this));
+}
+
+void Connection::OnCloseReq()
 {
 	try { MySock.close(); }
 	catch (...) { }
+
+	ClearRunState(RUNSTATE_CLOSEPENDING);
 }
 
-bool Connection::OnStep(unsigned int StepInterval, ConnectionBase **OutNextConn)
+void Connection::ClearRunState(RUNSTATE State)
 {
-	if (NextConn)
+	//Both states are cleared on MyStrand, so only one of the calls can see the last state cleared.
+	if ((RunStates.fetch_and(~(unsigned int)State) & ~(unsigned int)State)==0)
 	{
-		//Release our "next" connection, and immediately time out.
-		*OutNextConn=NextConn;
+		ConnectionBase *UpgradedConn=NextConn;
 		NextConn=nullptr;
-		SilentTime=Conf.MaxSilentTime;
+
+		//This must be the last access to the object: the manager might delete it after this.
+		MyManager->OnConnectionFinished(this,UpgradedConn);
+	}
+}
+
+void Connection::AcquireBuffers()
+{
+	if (!Buffs)
+		Buffs=BuffersPool::Acquire();
+}
+
+void Connection::ReleaseBuffers()
+{
+	if (Buffs)
+	{
+		Buffs->ReadBuff.Reset();
+		Buffs->WriteBuff.Reset(false);
+		BuffersPool::Release(Buffs);
+		Buffs=nullptr;
 	}
+}
 
-	SilentTime+=StepInterval;
-	if (SilentTime>Conf.MaxSilentTime)
+void Connection::OnReadable(const boost::system::error_code &error)
+{
+	if (!error)
+		boost::asio::spawn(MyStrand, boost::bind(&Connection::ProtocolHandler, this, boost::placeholders::_1), boost::asio::detached);
+	else
 	{
 		try { MySock.close(); }
 		catch (...) { }
-		return !IsDeletable;
+		ClearRunState(RUNSTATE_RUNNING);
 	}
-	else
-		return true;
 }
 
 void Connection::ContinueRead(boost::asio::yield_context &Yield)
 {
+	WriteAll(Yield);
+
 	unsigned int FreeLength;
-	unsigned char *ReadPos=ReadBuff.GetReadInfo(FreeLength);
+	unsigned char *ReadPos=Buffs->ReadBuff.GetReadInfo(FreeLength);
 
 	if (FreeLength)
 	{
 		std::size_t ReadCount=MySock.async_read_some(boost::asio::buffer(ReadPos, FreeLength), Yield);
-		ReadBuff.OnNewData(ReadCount);
-		SilentTime=0;
+		Buffs->ReadBuff.OnNewData(ReadCount);
+		MarkActive();
 	}
 }
 
-void Connection::WriteNext(boost::asio::yield_context &Yield)
+void Connection::WriteAll(boost::asio::yield_context &Yield)
 {
-	unsigned int WriteLength;
-	if (const unsigned char *WritePos=WriteBuff.Pop(WriteLength))
+	while (true)
 	{
-		boost::asio::async_write(MySock,boost::asio::buffer(WritePos,WriteLength),Yield);
-		WriteBuff.Release();
-		SilentTime=0;
+		const std::vector<boost::asio::const_buffer> &BuffA=Buffs->WriteBuff.PopAll();
+		if (BuffA.empty())
+			break;
+
+		std::size_t WriteLength=MySock.async_write_some(BuffA,Yield);
+		Buffs->WriteBuff.Release(WriteLength);
+		MarkActive();
 	}
 }
 
-void Connection::WriteAll(boost::asio::yield_context &Yield)
+#ifdef UD_SENDFILE_SUPPORTED
+unsigned long long Connection::SendFileContent(UD::FileUtils::FileHandle File, unsigned long long Offset, unsigned long long Length,
+	boost::asio::yield_context &Yield)
 {
-	unsigned int WriteLength;
-	while (const unsigned char *WritePos=WriteBuff.Pop(WriteLength))
+	//sendfile() is called directly on the socket, so it must not block the thread when the socket buffer is full.
+	if (!MySock.native_non_blocking())
+		MySock.native_non_blocking(true);
+
+	unsigned long long RemLength=Length;
+	while (RemLength)
 	{
-		boost::asio::async_write(MySock,boost::asio::buffer(WritePos,WriteLength),Yield);
-		WriteBuff.Release();
-		SilentTime=0;
+		long long SentLength=UD::FileUtils::SendFile(MySock.native_handle(),File,Offset,
+			RemLength<BuildConfig::SendFileChunkSize ? (std::size_t)RemLength : (std::size_t)BuildConfig::SendFileChunkSize);
+
+		if (SentLength>0)
+		{
+			RemLength-=SentLength;
+			MarkActive();
+		}
+		else if ((SentLength<0) && ((errno==EAGAIN) || (errno==EWOULDBLOCK)))
+			MySock.async_wait(boost::asio::ip::tcp::socket::wait_write,Yield);
+		else
+			//Socket error, or the file was truncated.
+			break;
 	}
+
+	return Length-RemLength;
+}
+#endif
+
+bool Connection::IsWriteQueueFull() const
+{
+	return (Buffs->WriteBuff.GetPendingCount()>=BuildConfig::MaxGatherWriteCount) ||
+		(Buffs->WriteBuff.GetPendingLength()>=BuildConfig::WriteBuffSize);
 }
 
 void Connection::ProtocolHandler(boost::asio::yield_context Yield)
@@ -129,6 +257,9 @@ void Connection::ProtocolHandler(boost::asio::yield_context Yield)
 	- Discard every content byte, and start reading headers again.
 	*/
 
+	AcquireBuffers();
+
+	bool IsIdle=false;
 	try
 	{
 		bool IsKeepAlive=true;
@@ -144,6 +275,8 @@ void Connection::ProtocolHandler(boost::asio::yield_context Yield)
 				//Header parse error. Close the connection.
 				break;
 
+			CurrRespSource=MyManager->GetRespSource();
+
 			if (CurrMethod==METHOD_POST)
 			{
 				//Parse request content.
@@ -151,29 +284,61 @@ void Connection::ProtocolHandler(boost::asio::yield_context Yield)
 					break;
 			}
 
-			//Process the fully parsed response.
-			if (!ResponseHandler(Yield))
+			//Process the fully parsed response. It's only sent before the next request is parsed, if that isn't buffered yet.
+			bool IsResponseSent=ResponseHandler(Yield);
+			//The response is deleted by now: don't keep an old source alive, while waiting for the next request.
+			CurrRespSource.reset();
+			if (!IsResponseSent)
 				break;
 
 			//Clear every kept byte in the read buffer.
-			ReadBuff.ResetRelevant();
+			Buffs->ReadBuff.ResetRelevant();
 
-			if (CurrVersion==VERSION_10)
+			if ((CurrVersion==VERSION_10) || (IsContentLeft))
 				IsKeepAlive=false;
 			else if (CurrVersion==VERSION_11)
 				//We keep the connection alive by default, unless the client asks otherwise.
 				for (const auto &Header : HeaderA)
 					if ((Header.IntName==HTTP::HN_CONNECTION) && (CompareLowercaseSimple(Header.Value, "close")))
 						IsKeepAlive=false;
+
+			if ((IsKeepAlive) && (Conf.ReleaseIdleBuffers) && (!Buffs->ReadBuff.GetAvailableDataLength()))
+			{
+				//No pipelined request: wait for the next one without holding the coroutine and the buffers.
+				IsIdle=true;
+				break;
+			}
 		}
+
+		//Send the responses of the already processed requests.
+		WriteAll(Yield);
 	}
 	catch (boost::context::detail::forced_unwind &) { throw; }
 	catch (...)
 	{ }
 
+	//Drop the response of an unfinished request, and the response source.
+	delete BodyResp;
+	BodyResp=nullptr;
+	CurrRespSource.reset();
+
+	ReleaseBuffers();
+
+	if (IsIdle)
+	{
+		try
+		{
+			MySock.async_wait(boost::asio::ip::tcp::socket::wait_read,
+				boost::asio::bind_executor(MyStrand, boost::bind(&Connection::OnReadable, this, boost::asio::placeholders::error)));
+			return;
+		}
+		catch (...)
+		{ }
+	}
+
 	try { MySock.close(); }
 	catch (...) { }
-	IsDeletable=true;
+	ClearRunState(RUNSTATE_RUNNING);
 }
 
 bool Connection::HeaderHandler(boost::asio::yield_context Yield)
@@ -181,14 +346,14 @@ bool Connection::HeaderHandler(boost::asio::yield_context Yield)
 	//Read the header block.
 
 	bool RequestLineFound=false;
-	unsigned int LineStartPos=0;
+	unsigned int LineStartPos=0, ColonPos=0; //Relative to the relevant data. ColonPos is 0, until the colon of the current header line is found.
 	while (true)
 	{
-		if (!ReadBuff.GetAvailableDataLength())
+		if (!Buffs->ReadBuff.GetAvailableDataLength())
 		{
 			ContinueRead(Yield);
 
-			if (!ReadBuff.GetAvailableDataLength())
+			if (!Buffs->ReadBuff.GetAvailableDataLength())
 				//Headers longer than static read buffer.
 				return false;
 		}
@@ -198,61 +363,77 @@ bool Connection::HeaderHandler(boost::asio::yield_context Yield)
 			ReqStartTime=std::chrono::steady_clock::now();
 
 		unsigned int AvailableDataLength;
-		const unsigned char *InBuff=ReadBuff.GetAvailableData(AvailableDataLength), *InBuffEnd=InBuff+AvailableDataLength;
+		unsigned char *InBuff=Buffs->ReadBuff.GetAvailableData(AvailableDataLength), *InBuffEnd=InBuff+AvailableDataLength;
 
 		unsigned int RelevantDataLength;
-		const unsigned char *RelevantBuff=ReadBuff.GetRelevantData(RelevantDataLength);
+		unsigned char *RelevantBuff=Buffs->ReadBuff.GetRelevantData(RelevantDataLength);
 
-		//Parse this block of data.
-		while (InBuff!=InBuffEnd)
+		//Parse this block of data. Every byte is scanned once: header lines are searched for the colon and the line end
+		//together, and the header name is lowercased when it's colon is found.
+		while (true)
 		{
-			unsigned char CurrVal=*InBuff;
-			if (CurrVal=='\n')
+			if ((RequestLineFound) && (!ColonPos))
 			{
-				if (InBuff-RelevantBuff-LineStartPos>1)
+				InBuff=UD::CharScan::FindEither(InBuff,InBuffEnd,':','\n');
+				if ((InBuff!=InBuffEnd) && (*InBuff==':'))
 				{
-					//This is a non-empty line.
-					if (RequestLineFound)
-						HeaderA.push_back(Header((char *)RelevantBuff+LineStartPos,(char *)InBuff));
-					else
-					{
-						//This is the request line.
-						if (ParseRequestLine(RelevantBuff,InBuff))
-							RequestLineFound=true;
-						else
-							return false;
-					}
-
-					LineStartPos=InBuff-RelevantBuff+1;
+					ColonPos=(unsigned int)(InBuff-RelevantBuff);
+					UD::CharScan::ToLower(RelevantBuff+LineStartPos,InBuff);
+					++InBuff;
+					continue;
 				}
+			}
+			else
+				InBuff=UD::CharScan::Find(InBuff,InBuffEnd,'\n');
+
+			if (InBuff==InBuffEnd)
+				break;
+
+			if (InBuff-RelevantBuff-LineStartPos>1)
+			{
+				//This is a non-empty line.
+				if (RequestLineFound)
+					HeaderA.push_back(Header((char *)RelevantBuff+LineStartPos,ColonPos ? (char *)RelevantBuff+ColonPos : nullptr,(char *)InBuff));
 				else
 				{
-					//This is an empty line. Consume every byte so far, including this one.
-					ReadBuff.Consume(InBuff-ReadBuff.GetAvailableData(AvailableDataLength)+1,true);
-					return true;
+					//This is the request line.
+					if (ParseRequestLine(RelevantBuff,InBuff))
+						RequestLineFound=true;
+					else
+						return false;
 				}
+
+				LineStartPos=(unsigned int)(InBuff-RelevantBuff+1);
+				ColonPos=0;
+			}
+			else
+			{
+				//This is an empty line. Consume every byte so far, including this one.
+				Buffs->ReadBuff.Consume(InBuff-Buffs->ReadBuff.GetAvailableData(AvailableDataLength)+1,true);
+				return true;
 			}
 
 			++InBuff;
 		}
 
 		//Consume every byte we've read.
-		ReadBuff.Consume(AvailableDataLength,true);
+		Buffs->ReadBuff.Consume(AvailableDataLength,true);
 		ContinueRead(Yield);
 	}
 
 	return false;
 }
 
-bool Connection::ContentHandler(boost::asio::yield_context Yield)
+bool Connection::ContentHandler(boost::asio::yield_context &Yield)
 {
-	//This is a POST request. Search for a content-type and a content-length header.
+	//This is a POST request. Search for the content-type, content-length, transfer-encoding and expect headers.
 	enum HEADERFLAG
 	{
-		HF_CONTENTTYPE    = 1 << 0,
-		HF_CONTENTLENGTH  = 1 << 1,
-		HF_REQUIRED       = HF_CONTENTLENGTH,
-		HF_ALL            = HF_CONTENTLENGTH | HF_CONTENTTYPE,
+		HF_CONTENTTYPE      = 1 << 0,
+		HF_CONTENTLENGTH    = 1 << 1,
+		HF_TRANSFERENCODING = 1 << 2,
+		HF_EXPECTCONTINUE   = 1 << 3,
+		HF_ALL              = HF_CONTENTLENGTH | HF_CONTENTTYPE | HF_TRANSFERENCODING | HF_EXPECTCONTINUE,
 	};
 
 	unsigned int HeaderFoundFlags=0;
@@ -270,93 +451,350 @@ bool Connection::ContentHandler(boost::asio::yield_context Yield)
 			CurrQuery.OnBoundaryParsed();
 			HeaderFoundFlags|=HF_CONTENTTYPE;
 		}
+		else if (CurrHeader.IntName==HN_TRANSFER_ENCODING)
+		{
+			//Only the chunked transfer coding is supported.
+			if (!CompareLowercaseSimple(CurrHeader.Value,"chunked"))
+				return false;
+
+			HeaderFoundFlags|=HF_TRANSFERENCODING;
+		}
+		else if ((CurrHeader.IntName==HN_EXPECT) && (CurrVersion==VERSION_11) && (CompareLowercaseSimple(CurrHeader.Value,"100-continue")))
+			//The expectation is ignored in HTTP/1.0 requests.
+			HeaderFoundFlags|=HF_EXPECTCONTINUE;
 
 		if ((HeaderFoundFlags & HF_ALL)==HF_ALL)
 			break;
 	}
 
-	if ((HeaderFoundFlags & HF_REQUIRED)!=HF_REQUIRED)
+	IsContentChunked=(HeaderFoundFlags & HF_TRANSFERENCODING)!=0;
+	if (IsContentChunked)
+		//The transfer coding overrides the content-length.
+		ContentLength=0;
+	else if (!(HeaderFoundFlags & HF_CONTENTLENGTH))
 		return false;
 
+	ContentRemLength=ContentLength;
+	ChunkState=CS_SIZE;
+
 	ContentBuff=nullptr;
 	ContentEndBuff=nullptr;
 
-	if (!ContentLength)
+	if ((!ContentLength) && (!IsContentChunked))
 		//No content to parse.
 		return true;
-	else if (ContentLength>Conf.MaxPostBodyLength)
+
+	bool IsStreamed=((ContentType==CT_URL_ENCODED) || (ContentType==CT_UNKNOWN)) &&
+		(CurrRespSource->IsBodyStreamed(CurrMethod,CurrResource,HeaderA));
+	bool IsTooLarge=(!IsStreamed) && (ContentLength>Conf.MaxPostBodyLength);
+	if ((HeaderFoundFlags & HF_EXPECTCONTINUE) && (!AcceptContent(IsTooLarge,Yield)))
+		//Rejected before reading the body.
+		return true;
+	else if (IsStreamed)
+		return StreamContent(Yield);
+	else if (IsTooLarge)
 		//Content too large.
 		return false;
 
 	if ((ContentType==CT_URL_ENCODED) || (ContentType==CT_UNKNOWN))
 	{
-		while (!ReadBuff.RequestData((unsigned int)ContentLength))
-			ContinueRead(Yield);
+		if (!IsContentChunked)
+		{
+			while (!Buffs->ReadBuff.RequestData((unsigned int)ContentLength))
+				ContinueRead(Yield);
 
-		//The actual content is the currently available data.
-		unsigned int AvailableLength;
-		ContentBuff=ReadBuff.GetAvailableData(AvailableLength);
-		ContentEndBuff=ContentBuff+AvailableLength;
+			//The actual content is the currently available data.
+			unsigned int AvailableLength;
+			ContentBuff=Buffs->ReadBuff.GetAvailableData(AvailableLength);
+			ContentEndBuff=ContentBuff+AvailableLength;
+
+			Buffs->ReadBuff.Consume(AvailableLength,true);
+		}
+		else
+		{
+			//The chunks are decoded into a separate buffer.
+			SaveHeaders();
+
+			while (true)
+			{
+				const unsigned char *PartBuff;
+				unsigned int PartLength;
+				if (!ReadContent(PartBuff,PartLength,Yield))
+					return false;
+				else if (!PartLength)
+					break;
+				else if (ContentLength+PartLength>Conf.MaxPostBodyLength)
+					return false;
+
+				ChunkedContent.insert(ChunkedContent.end(),PartBuff,PartBuff+PartLength);
+				ConsumeContent(PartLength);
+			}
+
+			ContentBuff=ChunkedContent.data();
+			ContentEndBuff=ContentBuff+ChunkedContent.size();
+		}
 
 		if (ContentType==CT_URL_ENCODED)
 			CurrQuery.AddURLEncoded((const char *)ContentBuff,(const char *)ContentEndBuff);
 
-		ReadBuff.Consume(AvailableLength,true);
 		return true;
 	}
 	else if (ContentType==CT_FORM_MULTIPART)
 	{
-		//We have to save the header's contents from the read buffer to a separate buffer.
-		unsigned int RelevantLength;
-		const unsigned char *RelevantBuff=ReadBuff.GetRelevantData(RelevantLength);
+		SaveHeaders();
+
+		while (true)
+		{
+			const unsigned char *PartBuff;
+			unsigned int PartLength;
+			if (!ReadContent(PartBuff,PartLength,Yield))
+				return false;
+			else if (!PartLength)
+				break;
+			else if ((IsContentChunked) && (ContentLength+PartLength>Conf.MaxPostBodyLength))
+				return false;
+
+			if (UploadHelper)
+				//The rest of the body is the upper limit of the length of the next file.
+				UploadHelper->SetMaxRemainingLength(IsContentChunked ? ~0ULL : ContentRemLength);
+
+			CurrQuery.AppendFormMultipart((const char *)PartBuff,(const char *)PartBuff+PartLength);
+			ConsumeContent(PartLength);
+
+			//Don't read more of the body, while the writer threads are behind.
+			if ((UploadHelper) && (!UploadHelper->WaitForSpace(Yield)))
+			{
+				//The rest of the body is dropped together with the connection.
+				RejectUploads();
+				IsContentLeft=true;
+				return true;
+			}
+		}
+
+		//The response source can only use the files, after they were written.
+		if ((UploadHelper) && (!UploadHelper->Flush(Yield)))
+			RejectUploads();
+
+		return true;
+	}
+	else
+		//Unknown ContentType.
+		return false;
+}
+
+void Connection::RejectUploads()
+{
+	UploadHelper->Reset();
+	CurrQuery.DeleteUploadedFiles();
+
+	BodyResp=new RespSource::CommonError::Response(CurrResource,HeaderA,nullptr,RC_SERVERERROR);
+	BodyRespCORS=true;
+}
+
+bool Connection::AcceptContent(bool IsTooLarge, boost::asio::yield_context &Yield)
+{
+	if (IsTooLarge)
+		BodyResp=new RespSource::CommonError::Response(CurrResource,HeaderA,nullptr,RC_PAYLOADTOOLARGE);
+	else
+	{
+		IRespSource::AsyncHelperHolder AsyncHelper(MyStrand,MyIOS,Yield);
+		try
+		{
+			BodyResp=CurrRespSource->OnExpectContinue(CurrMethod,CurrResource,CurrQuery,HeaderA,AsyncHelper,this);
+		}
+		catch (boost::context::detail::forced_unwind &) { throw; }
+		catch (const std::exception &Ex)
+		{
+			BodyResp=ErrorRS->CreateFromException(CurrMethod,CurrResource,CurrQuery,
+				HeaderA,ContentBuff,ContentEndBuff,AsyncHelper,this,&Ex);
+		}
+	}
+
+	if (BodyResp)
+	{
+		//The client might send the body anyway: it's dropped together with the connection.
+		BodyRespCORS=true;
+		IsContentLeft=true;
+		return false;
+	}
 
-		if ((unsigned int)(PostHeaderBuffEnd-PostHeaderBuff)<RelevantLength)
+	if (!Buffs->ReadBuff.GetAvailableDataLength())
+	{
+		//The interim response is sent before the first read of the body. It's not needed, if the body is already arriving.
+		static const char ContinueResp[]="HTTP/1.1 100 Continue\r\n\r\n";
+		static const unsigned int ContinueRespLength=sizeof(ContinueResp)-1;
+		memcpy(Buffs->WriteBuff.Allocate(ContinueRespLength),ContinueResp,ContinueRespLength);
+		Buffs->WriteBuff.Commit(ContinueRespLength);
+	}
+
+	return true;
+}
+
+bool Connection::StreamContent(boost::asio::yield_context &Yield)
+{
+	//The response might keep pointers to the headers, while the read buffer is reused for the body.
+	SaveHeaders();
+
+	BodyResp=CreateResponse(Yield,BodyRespCORS);
+
+	while (true)
+	{
+		const unsigned char *PartBuff;
+		unsigned int PartLength;
+		if (!ReadContent(PartBuff,PartLength,Yield))
+			return false;
+		else if (!PartLength)
+			return true;
+
+		bool IsAccepted;
+		try
 		{
-			delete[] PostHeaderBuff;
-			PostHeaderBuff=new char[RelevantLength];
-			PostHeaderBuffEnd=PostHeaderBuff+RelevantLength;
+			IsAccepted=BodyResp->OnBodyData(PartBuff,PartBuff+PartLength,Yield);
+		}
+		catch (boost::context::detail::forced_unwind &) { throw; }
+		catch (const std::exception &Ex)
+		{
+			delete BodyResp;
+			BodyResp=nullptr;
+			BodyResp=ErrorRS->CreateFromException(CurrMethod,CurrResource,CurrQuery,
+				HeaderA,ContentBuff,ContentEndBuff,IRespSource::AsyncHelperHolder(MyStrand,MyIOS,Yield),this,&Ex);
+			BodyRespCORS=true;
+			IsAccepted=false;
 		}
 
-		memcpy(PostHeaderBuff,RelevantBuff,RelevantLength);
+		if (!IsAccepted)
+		{
+			//The rest of the body is dropped together with the connection.
+			IsContentLeft=true;
+			return true;
+		}
 
-		//Now that we have the header's data saved, we have to offset the Header structures' internal pointers.
-		std::ptrdiff_t Offset=PostHeaderBuff-(const char *)RelevantBuff;
-		for (Header &CurrHeader : HeaderA)
+		ConsumeContent(PartLength);
+	}
+}
+
+bool Connection::ReadContent(const unsigned char *&OutBuff, unsigned int &OutLength, boost::asio::yield_context &Yield)
+{
+	//Parse the chunked encoding, until there's chunk data to read, or the body is finished.
+	while ((IsContentChunked) && (ChunkState!=CS_DATA))
+	{
+		if (ChunkState==CS_FINISHED)
 		{
-			CurrHeader.Name+=Offset;
-			CurrHeader.Value+=Offset;
+			OutLength=0;
+			return true;
 		}
 
-		//We can now release the buffer space held by the headers' data, and start reading the content in chunks.
-		ReadBuff.ResetRelevant();
+		const unsigned char *LineEnd;
+		unsigned int LineLength;
+		const unsigned char *Line=ReadChunkLine(LineEnd,LineLength,Yield);
+		if (!Line)
+			return false;
 
-		unsigned long long RemLength=ContentLength;
-		while (RemLength)
+		switch (ChunkState)
 		{
-			unsigned int AvailableLength;
-			const unsigned char *AvailableBuff=ReadBuff.GetAvailableData(AvailableLength);
-			if (AvailableLength<RemLength)
-			{
-				CurrQuery.AppendFormMultipart((const char *)AvailableBuff,(const char *)AvailableBuff+AvailableLength);
-				ReadBuff.Consume((unsigned int)AvailableLength);
-				RemLength-=AvailableLength;
+		case CS_SIZE:
+			if (!ParseChunkSize(Line,LineEnd,ContentRemLength))
+				return false;
 
-				ReadBuff.RequestData(RemLength<BuildConfig::ReadBuffSize ? (unsigned int)RemLength : BuildConfig::ReadBuffSize);
-				ContinueRead(Yield);
-			}
-			else
-			{
-				CurrQuery.AppendFormMultipart((const char *)AvailableBuff,(const char *)AvailableBuff+RemLength);
-				ReadBuff.Consume((unsigned int)RemLength);
-				RemLength=0;
-			}
+			ChunkState=ContentRemLength ? CS_DATA : CS_TRAILER;
+			break;
+		case CS_DATAEND:
+			if (Line!=LineEnd)
+				return false;
+
+			ChunkState=CS_SIZE;
+			break;
+		default:
+			//The trailer fields are ignored, until the closing empty line.
+			if (Line==LineEnd)
+				ChunkState=CS_FINISHED;
+			break;
 		}
 
+		Buffs->ReadBuff.Consume(LineLength);
+	}
+
+	if (!ContentRemLength)
+	{
+		OutLength=0;
 		return true;
 	}
-	else
-		//Unknown ContentType.
-		return false;
+
+	unsigned int AvailableLength;
+	OutBuff=Buffs->ReadBuff.GetAvailableData(AvailableLength);
+	while (!AvailableLength)
+	{
+		Buffs->ReadBuff.RequestData(ContentRemLength<BuildConfig::ReadBuffSize ? (unsigned int)ContentRemLength : BuildConfig::ReadBuffSize);
+		ContinueRead(Yield);
+		OutBuff=Buffs->ReadBuff.GetAvailableData(AvailableLength);
+	}
+
+	OutLength=AvailableLength<ContentRemLength ? AvailableLength : (unsigned int)ContentRemLength;
+	return true;
+}
+
+void Connection::ConsumeContent(unsigned int Length)
+{
+	Buffs->ReadBuff.Consume(Length);
+	ContentRemLength-=Length;
+
+	if (IsContentChunked)
+	{
+		ContentLength+=Length;
+		if (!ContentRemLength)
+			ChunkState=CS_DATAEND;
+	}
+}
+
+const unsigned char *Connection::ReadChunkLine(const unsigned char *&OutEnd, unsigned int &OutLength, boost::asio::yield_context &Yield)
+{
+	while (true)
+	{
+		unsigned int AvailableLength;
+		const unsigned char *AvailableBuff=Buffs->ReadBuff.GetAvailableData(AvailableLength);
+		const unsigned char *LineEnd=UD::CharScan::Find(AvailableBuff,AvailableBuff+AvailableLength,'\n');
+		if (LineEnd!=AvailableBuff+AvailableLength)
+		{
+			OutLength=(unsigned int)(LineEnd-AvailableBuff)+1;
+			if ((LineEnd!=AvailableBuff) && (LineEnd[-1]=='\r'))
+				--LineEnd;
+
+			OutEnd=LineEnd;
+			return AvailableBuff;
+		}
+		else if (AvailableLength>=BuildConfig::MaxChunkLineLength)
+			return nullptr;
+
+		Buffs->ReadBuff.RequestData(AvailableLength+1);
+		ContinueRead(Yield);
+	}
+}
+
+void Connection::SaveHeaders()
+{
+	//We have to save the header's contents from the read buffer to a separate buffer.
+	unsigned int RelevantLength;
+	const unsigned char *RelevantBuff=Buffs->ReadBuff.GetRelevantData(RelevantLength);
+
+	if ((unsigned int)(PostHeaderBuffEnd-PostHeaderBuff)<RelevantLength)
+	{
+		delete[] PostHeaderBuff;
+		PostHeaderBuff=new char[RelevantLength];
+		PostHeaderBuffEnd=PostHeaderBuff+RelevantLength;
+	}
+
+	memcpy(PostHeaderBuff,RelevantBuff,RelevantLength);
+
+	//Now that we have the header's data saved, we have to offset the Header structures' internal pointers.
+	std::ptrdiff_t Offset=PostHeaderBuff-(const char *)RelevantBuff;
+	for (Header &CurrHeader : HeaderA)
+	{
+		CurrHeader.Name+=Offset;
+		CurrHeader.Value+=Offset;
+	}
+
+	//We can now release the buffer space held by the headers' data, and start reading the content in chunks.
+	Buffs->ReadBuff.ResetRelevant();
 }
 
 bool Connection::ParseRequestLine(const unsigned char *Begin, const unsigned char *End)
@@ -442,16 +880,12 @@ bool Connection::ParseRequestLine(const unsigned char *Begin, const unsigned cha
 	}
 }
 
-bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
+IResponse *Connection::CreateResponse(boost::asio::yield_context &Yield, bool &OutWriteCORSHeaders)
 {
-	ResponseCount++;
-
-	std::chrono::steady_clock::time_point ReqEndTime=std::chrono::steady_clock::now();
-
 	IResponse *CurrResp;
 	IRespSource::AsyncHelperHolder AsyncHelper(MyStrand, MyIOS,Yield);
 
-	bool WriteCORSHeaders;
+	OutWriteCORSHeaders=true;
 	try
 	{
 		if (HandleCORS())
@@ -463,31 +897,50 @@ bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
 			if (!CurrResp)
 			{
 				//Not a CORS preflight request.
-				CurrResp=MyRespSource->Create(CurrMethod, CurrResource, CurrQuery,
+				CurrResp=CurrRespSource->Create(CurrMethod, CurrResource, CurrQuery,
 					HeaderA, ContentBuff, ContentEndBuff, AsyncHelper, this);
-				WriteCORSHeaders=true;
+				OutWriteCORSHeaders=true;
 			}
 			else
-				WriteCORSHeaders=false;
+				OutWriteCORSHeaders=false;
 		}
 		else
-			CurrResp=MyRespSource->Create(CurrMethod,CurrResource,CurrQuery,
+			CurrResp=CurrRespSource->Create(CurrMethod,CurrResource,CurrQuery,
 				HeaderA,ContentBuff,ContentEndBuff,AsyncHelper,this);
 	}
 	catch (const std::exception &Ex)
 	{
 		CurrResp=ErrorRS->CreateFromException(CurrMethod,CurrResource,CurrQuery,
 			HeaderA,ContentBuff,ContentEndBuff,AsyncHelper,this,&Ex);
-		WriteCORSHeaders=true;
+		OutWriteCORSHeaders=true;
 	}
 	catch (...)
 	{
 		CurrResp=ErrorRS->Create(CurrMethod,CurrResource,CurrQuery,
 			HeaderA,ContentBuff,ContentEndBuff,AsyncHelper,this);
-		WriteCORSHeaders=true;
+		OutWriteCORSHeaders=true;
+	}
+
+	return CurrResp;
+}
+
+bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
+{
+	ResponseCount++;
+
+	std::chrono::steady_clock::time_point ReqEndTime=std::chrono::steady_clock::now();
+
+	bool WriteCORSHeaders;
+	IResponse *CurrResp=BodyResp;
+	if (CurrResp)
+	{
+		BodyResp=nullptr;
+		WriteCORSHeaders=BodyRespCORS;
 	}
+	else
+		CurrResp=CreateResponse(Yield,WriteCORSHeaders);
 
-	char *CurrPos=(char *)WriteBuff.Allocate(Conf.MaxHeadersLength);
+	char *CurrPos=(char *)Buffs->WriteBuff.Allocate(Conf.MaxHeadersLength);
 	char *CurrPosBegin=CurrPos;
 	char *CurrPosEnd=CurrPos+Conf.MaxHeadersLength - 2; //Leave room for the final "\r\n".
 
@@ -536,23 +989,63 @@ bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
 		}
 	}
 
-	//Close the headers, and send them to the client.
+	//Close the headers. They are sent together with the content.
 	CurrPos+=snprintf(CurrPos, CurrPosEnd-CurrPos,"\r\n");
-	WriteBuff.Commit((unsigned int)(CurrPos-CurrPosBegin));
-	WriteNext(Yield);
+	Buffs->WriteBuff.Commit((unsigned int)(CurrPos-CurrPosBegin));
 
 	if (RespLength!=~(unsigned long long)0)
 	{
 		unsigned long long TotalWriteLength=0;
 
-		bool RetVal=false;
+		bool RetVal=!RespLength;
+
+		boost::asio::const_buffer RespBuffA[IResponse::MaxContentBufferCount];
+		std::shared_ptr<const void> RespBuffOwner;
+		unsigned int RespBuffCount=RespLength ? CurrResp->GetContentBuffers(RespBuffA,RespBuffOwner) : 0;
+		if (RespBuffCount)
+		{
+			//Queue the content without copying: it's sent together with the headers.
+			for (unsigned int BuffI=0; BuffI!=RespBuffCount; ++BuffI)
+			{
+				//Very large buffers are queued in parts, as queued buffer lengths are 32 bit.
+				const unsigned char *CurrBuff=(const unsigned char *)RespBuffA[BuffI].data();
+				for (std::size_t RemLength=RespBuffA[BuffI].size(); RemLength; )
+				{
+					unsigned int PushLength=RemLength<0x40000000 ? (unsigned int)RemLength : 0x40000000;
+					Buffs->WriteBuff.PushExternal(CurrBuff,PushLength,RespBuffOwner);
+					CurrBuff+=PushLength;
+					RemLength-=PushLength;
+				}
+			}
+
+			TotalWriteLength=RespLength;
+			RetVal=true;
+			RespLength=0;
+		}
+
+#ifdef UD_SENDFILE_SUPPORTED
+		UD::FileUtils::FileHandle ContentFile;
+		unsigned long long ContentOffset;
+		if ((RespLength>=BuildConfig::SendFileMinLength) && (CurrResp->GetContentFile(ContentFile,ContentOffset)))
+		{
+			//Send the headers, then the content directly from the file.
+			WriteAll(Yield);
+			TotalWriteLength=SendFileContent(ContentFile,ContentOffset,RespLength,Yield);
+			RetVal=TotalWriteLength==RespLength;
+			RespLength=0;
+		}
+#endif
+
 		while (RespLength)
 		{
-			SilentTime=0;
-			CurrPos=(char *)WriteBuff.Allocate(BuildConfig::WriteBuffSize);
+			MarkActive();
+
+			//Small contents are allocated exactly, so they can be concatenated with the headers in the write queue.
+			unsigned int ChunkLength=RespLength<BuildConfig::WriteBuffSize ? (unsigned int)RespLength : BuildConfig::WriteBuffSize;
+			CurrPos=(char *)Buffs->WriteBuff.Allocate(ChunkLength);
 
 			unsigned int ReadLength;
-			bool IsFinished=CurrResp->Read((unsigned char *)CurrPos,BuildConfig::WriteBuffSize,ReadLength,
+			bool IsFinished=CurrResp->Read((unsigned char *)CurrPos,ChunkLength,ReadLength,
 				Yield);
 
 			if (ReadLength<=RespLength)
@@ -560,9 +1053,10 @@ bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
 			else
 				RespLength=0;
 
-			WriteBuff.Commit(ReadLength);
+			Buffs->WriteBuff.Commit(ReadLength);
 			TotalWriteLength+=ReadLength;
-			WriteNext(Yield);
+			if (IsWriteQueueFull())
+				WriteAll(Yield);
 
 			if ((IsFinished) && (!RespLength))
 			{
@@ -576,10 +1070,12 @@ bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
 			}
 		}
 
-		WriteAll(Yield);
+		if ((!Buffs->ReadBuff.GetAvailableDataLength()) || (RespCode==RC_SWITCH_PROT) || (IsWriteQueueFull()))
+			WriteAll(Yield);
 
-		NextConn=CurrResp->Upgrade(this);
+		ConnectionBase *UpgradedConn=CurrResp->Upgrade(this);
 		delete CurrResp;
+		MyManager->OnResponseFinished(this);
 
 		std::chrono::steady_clock::time_point RespEndTime=std::chrono::steady_clock::now();
 
@@ -588,9 +1084,11 @@ bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
 			RespCode,TotalWriteLength,
 			(ReqEndTime-ReqStartTime).count()/(double)std::chrono::steady_clock::duration::period::den,
 			(RespEndTime-ReqEndTime).count()/(double)std::chrono::steady_clock::duration::period::den,
-			NextConn);
+			UpgradedConn);
+
+		NextConn=UpgradedConn;
 
-		return RetVal && !NextConn;
+		return RetVal && !UpgradedConn;
 	}
 	else
 	{
@@ -601,8 +1099,8 @@ bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
 		unsigned long long TotalWriteLength=0;
 		while (true)
 		{
-			SilentTime=0;
-			CurrPos=(char *)WriteBuff.Allocate(BuildConfig::WriteBuffSize);
+			MarkActive();
+			CurrPos=(char *)Buffs->WriteBuff.Allocate(BuildConfig::WriteBuffSize);
 
 			unsigned int ReadLength;
 			bool IsFinished=CurrResp->Read((unsigned char *)CurrPos + ChunkHeaderLen,BuildConfig::WriteBuffSize - ChunkHeaderLen - ChunkFooterLength,ReadLength,
@@ -615,28 +1113,30 @@ bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
 				CurrPos[ReadLength + ChunkHeaderLen]='\r';
 				CurrPos[ReadLength + ChunkHeaderLen + 1]='\n';
 
-				WriteBuff.Commit(ReadLength + ChunkHeaderLen + ChunkFooterLength);
+				Buffs->WriteBuff.Commit(ReadLength + ChunkHeaderLen + ChunkFooterLength);
 				TotalWriteLength+=ReadLength;
 			}
 			else
 			{
 				IsFinished=true;
-				WriteBuff.Commit(0);
+				Buffs->WriteBuff.Commit(0);
 			}
 
 			if (!IsFinished)
-				WriteNext(Yield);
+				WriteAll(Yield);
 			else
 				break;
 		}
 
-		CurrPos=(char *)WriteBuff.Allocate(FinalChunkLength);
+		CurrPos=(char *)Buffs->WriteBuff.Allocate(FinalChunkLength);
 		memcpy(CurrPos,"0\r\n\r\n",FinalChunkLength);
-		WriteBuff.Commit(FinalChunkLength);
-		WriteAll(Yield);
+		Buffs->WriteBuff.Commit(FinalChunkLength);
+		if ((!Buffs->ReadBuff.GetAvailableDataLength()) || (RespCode==RC_SWITCH_PROT) || (IsWriteQueueFull()))
+			WriteAll(Yield);
 
-		NextConn=CurrResp->Upgrade(this);
+		ConnectionBase *UpgradedConn=CurrResp->Upgrade(this);
 		delete CurrResp;
+		MyManager->OnResponseFinished(this);
 
 		std::chrono::steady_clock::time_point RespEndTime=std::chrono::steady_clock::now();
 
@@ -645,9 +1145,11 @@ bool Connection::ResponseHandler(boost::asio::yield_context &Yield)
 			RespCode,TotalWriteLength,
 			(ReqEndTime-ReqStartTime).count()/(double)std::chrono::steady_clock::duration::period::den,
 			(RespEndTime-ReqEndTime).count()/(double)std::chrono::steady_clock::duration::period::den,
-			NextConn);
+			UpgradedConn);
+
+		NextConn=UpgradedConn;
 
-		return !NextConn;
+		return !UpgradedConn;
 	}
 }
 
@@ -657,8 +1159,19 @@ void Connection::ResetRequestData()
 	CurrMethod=METHOD_UNKNOWN;
 
 	CurrResource.reserve(CurrResource.capacity());
-	CurrQuery=QueryParams();
+	if (UploadHelper)
+	{
+		UploadHelper->Reset();
+		CurrQuery=QueryParams(UploadHelper.get());
+	}
+	else
+		CurrQuery=QueryParams(FUConf);
 	ContentLength=0;
+	IsContentLeft=false;
+	IsContentChunked=false;
+	if (!ChunkedContent.empty())
+		//Don't keep the memory of large bodies with the connection.
+		std::vector<unsigned char>().swap(ChunkedContent);
 
 	HeaderA.reserve(HeaderA.capacity());
 	HeaderA.clear();
@@ -676,6 +1189,34 @@ METHOD Connection::ParseMethod(const unsigned char *Begin, const unsigned char *
 		return METHOD_UNKNOWN;
 }
 
+bool Connection::ParseChunkSize(const unsigned char *Begin, const unsigned char *End, unsigned long long &OutSize)
+{
+	OutSize=0;
+
+	const unsigned char *CurrPos=Begin;
+	for (; CurrPos!=End; ++CurrPos)
+	{
+		unsigned char Val=*CurrPos;
+		unsigned int Digit;
+		if ((Val>='0') && (Val<='9'))
+			Digit=Val-'0';
+		else if ((Val>='a') && (Val<='f'))
+			Digit=Val-'a'+10;
+		else if ((Val>='A') && (Val<='F'))
+			Digit=Val-'A'+10;
+		else
+			break;
+
+		if (OutSize>>60)
+			//Too large.
+			return false;
+
+		OutSize=(OutSize<<4) | Digit;
+	}
+
+	return (CurrPos!=Begin) && ((CurrPos==End) || (*CurrPos==';') || (*CurrPos==' ') || (*CurrPos=='\t'));
+}
+
 bool Connection::CompareLowercaseSimple(const char *TestStr, const char *LowerCaseStr)
 {
 	while (char Val=*TestStr++)
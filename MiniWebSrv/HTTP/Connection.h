@@ -1,12 +1,15 @@
 #pragma once
 
 #include <chrono>
+#include <atomic>
 #include <boost/bind/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/spawn.hpp>
 
 #include "Common/StreamReadBuff.h"
 #include "Common/WriteBuffQueue.h"
+#include "Common/ThreadLocalPool.h"
+#include "Common/FileUtils.h"
 
 #include "BuildConfig.h"
 #include "Common.h"
@@ -20,7 +23,9 @@ namespace HTTP
 {
 
 class IRespSource;
+class IResponse;
 class IServerLog;
+class AsyncFileUploadHelper;
 
 namespace RespSource
 {
@@ -35,30 +40,57 @@ public:
 		Config::Connection Conf=Config::Connection(), Config::FileUpload FUConf=Config::FileUpload());
 	virtual ~Connection();
 
-	virtual void Start(IRespSource *NewRespSource, IServerLog *NewLog);
-	/**Closes the connection socket.*/
+	virtual void Start(IServerLog *NewLog);
+	/**Closes the connection socket. Can be called from any thread.*/
 	virtual void Stop();
-	/**@return False, if the connection is closed, and it should be deleted.*/
-	virtual bool OnStep(unsigned int StepInterval, ConnectionBase **OutNextConn);
+	/**Closes the connection, if it was silent for too long.*/
+	virtual std::chrono::steady_clock::duration OnTimer(std::chrono::steady_clock::time_point Now);
+	/**Resets the connection to it's initial state. The read, write and header buffers are retained.*/
+	virtual bool Reset();
 
 protected:
 	boost::asio::io_context &MyIOS;
 	boost::asio::strand<boost::asio::io_context::executor_type> MyStrand;
 
-	unsigned int SilentTime;
-	bool IsDeletable;
+	enum RUNSTATE
+	{
+		RUNSTATE_RUNNING      = 1 << 0, //The protocol handler coroutine is running, or waiting for the next request.
+		RUNSTATE_CLOSEPENDING = 1 << 1, //A close request is posted to MyStrand.
+	};
+
+	std::atomic<std::chrono::steady_clock::rep> LastActiveTime; //Time of the last successful read or write.
+	std::atomic_uint RunStates; //The connection is finished, when it becomes zero.
 
 	VERSION CurrVersion;
 	METHOD CurrMethod;
 	std::string CurrResource;
 	QueryParams CurrQuery;
-	unsigned long long ContentLength; //Only valid when the client sent some data.
+	std::unique_ptr<AsyncFileUploadHelper> UploadHelper; //Only set, if the uploaded files are written asynchronously.
+	unsigned long long ContentLength; //Only valid when the client sent some data. For chunked bodies, it's the decoded length read so far.
 	unsigned char *ContentBuff, *ContentEndBuff; //Only valid if the current content type is unknown.
 	std::vector<Header> HeaderA;
 	std::chrono::steady_clock::time_point ReqStartTime;
 
+	enum CHUNKSTATE
+	{
+		CS_SIZE,     //Reading a chunk size line.
+		CS_DATA,     //Reading chunk data.
+		CS_DATAEND,  //Reading the line break after the chunk data.
+		CS_TRAILER,  //Reading the trailer lines, after the last chunk.
+		CS_FINISHED, //The whole body was read.
+	};
+
+	unsigned long long ContentRemLength; //The remaining length of the body, or of the current chunk, if it's chunked.
+	bool IsContentChunked;
+	CHUNKSTATE ChunkState;
+	std::vector<unsigned char> ChunkedContent; //The decoded body, if a chunked body is buffered.
+	//Keeps the response source alive until the current response is finished, even if it's replaced meanwhile.
+	std::shared_ptr<IRespSource> CurrRespSource;
+	IResponse *BodyResp; //The response, if it was created before reading the body (see IRespSource::IsBodyStreamed()).
+	bool BodyRespCORS; //True, if CORS headers should be sent with BodyResp.
+	bool IsContentLeft; //True, if the body of the current request wasn't read fully: the connection can't be reused.
+
 	const char *ServerName;
-	IRespSource *MyRespSource;
 	IServerLog *MyLog;
 
 	RespSource::CommonError *ErrorRS;
@@ -66,22 +98,80 @@ protected:
 
 	char *PostHeaderBuff, *PostHeaderBuffEnd;
 
-	UD::Comm::StreamReadBuff<BuildConfig::ReadBuffSize> ReadBuff;
-	UD::Comm::WriteBuffQueue<BuildConfig::WriteBuffSize, BuildConfig::WriteQueueInitSize> WriteBuff;
+	/**The read and write buffers of the connection. These are only held while the protocol handler is running.*/
+	struct Buffers
+	{
+		UD::Comm::StreamReadBuff<BuildConfig::ReadBuffSize> ReadBuff;
+		UD::Comm::WriteBuffQueue<BuildConfig::WriteBuffSize, BuildConfig::WriteQueueInitSize> WriteBuff;
+	};
+	typedef UD::Comm::ThreadLocalPool<Buffers, BuildConfig::BuffPoolSize> BuffersPool;
 
-	ConnectionBase *NextConn;
+	Buffers *Buffs;
+
+	ConnectionBase *NextConn; //The upgraded connection. Handed over to the manager, when this connection finishes.
 
 	const Config::Connection Conf;
+	const Config::FileUpload FUConf;
+
+	/**Posts a request to MyStrand to close the socket, if the protocol handler is still running.*/
+	void RequestClose();
+	void OnCloseReq();
+	/**Clears the given run state, and notifies the manager, if the connection is finished. Must be called on MyStrand.*/
+	void ClearRunState(RUNSTATE State);
 
+	inline void MarkActive() { LastActiveTime.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed); }
+
+	void AcquireBuffers();
+	void ReleaseBuffers();
+
+	/**Called when an idle keep-alive connection becomes readable. Restarts the protocol handler.*/
+	void OnReadable(const boost::system::error_code &error);
+
+	/**Reads more data into the read buffer. Any pending response data is sent first, as the client might wait for it.*/
 	void ContinueRead(boost::asio::yield_context &Yield);
-	void WriteNext(boost::asio::yield_context &Yield);
+	/**Sends every pending buffer of the write queue, with as few gather writes as possible.*/
 	void WriteAll(boost::asio::yield_context &Yield);
+	/**@return True, if the write queue shouldn't grow any further before sending it.*/
+	bool IsWriteQueueFull() const;
+#ifdef UD_SENDFILE_SUPPORTED
+	/**Sends a part of a file to the client with sendfile(). The write queue must be empty.
+	@return The number of bytes sent. Less than Length on error.*/
+	unsigned long long SendFileContent(UD::FileUtils::FileHandle File, unsigned long long Offset, unsigned long long Length,
+		boost::asio::yield_context &Yield);
+#endif
 
 	void ProtocolHandler(boost::asio::yield_context Yield);
 	bool HeaderHandler(boost::asio::yield_context Yield);
-	bool ContentHandler(boost::asio::yield_context Yield);
+	bool ContentHandler(boost::asio::yield_context &Yield);
+	/**Handles an "Expect: 100-continue" request header: either queues a "100 Continue" response, or creates the final
+	response of the request in BodyResp, without reading the body.
+	@param IsTooLarge If true, the request is rejected with 413, because it's body is too large to buffer.
+	@return True, if the body should be read.*/
+	bool AcceptContent(bool IsTooLarge, boost::asio::yield_context &Yield);
+	/**Deletes the uploaded files of the current request, after writing them failed, and creates a 500 response in
+	BodyResp, instead of passing the request to the response source.*/
+	void RejectUploads();
+	/**Passes the body of the current request to a response created before reading it, in chunks.*/
+	bool StreamContent(boost::asio::yield_context &Yield);
+	/**Moves the data of the headers out of the read buffer, so the rest of the request can be read in chunks.*/
+	void SaveHeaders();
+	/**Reads the next part of the body of the current request, which has either a known length, or chunked encoding.
+	The part stays in the read buffer, until it's consumed with ConsumeContent().
+	@param OutLength Receives the length of the part. It's 0 at the end of the body.
+	@return False, if the chunked encoding is invalid.*/
+	bool ReadContent(const unsigned char *&OutBuff, unsigned int &OutLength, boost::asio::yield_context &Yield);
+	void ConsumeContent(unsigned int Length);
+	/**Reads a line of the chunked encoding into the read buffer. It's consumed by the caller.
+	@param OutEnd Receives the end of the line, without the line break.
+	@param OutLength Receives the length of the line, with the line break.
+	@return The beginning of the line, or nullptr, if the line is too long.*/
+	const unsigned char *ReadChunkLine(const unsigned char *&OutEnd, unsigned int &OutLength, boost::asio::yield_context &Yield);
 	bool ParseRequestLine(const unsigned char *Begin, const unsigned char *End);
 
+	/**Creates the response for the current request, with CurrRespSource. Errors are converted to error responses.
+	@param OutWriteCORSHeaders Receives true, if CORS headers should be sent with the response.*/
+	IResponse *CreateResponse(boost::asio::yield_context &Yield, bool &OutWriteCORSHeaders);
+
 	/**@return True, if this connection should continue.*/
 	bool ResponseHandler(boost::asio::yield_context &Yield);
 
@@ -91,6 +181,8 @@ protected:
 
 	static METHOD ParseMethod(const unsigned char *Begin, const unsigned char *End);
 	static bool CompareLowercaseSimple(const char *TestStr, const char *LowerCaseStr);
+	/**Parses the hexadecimal size of a chunk. It can be followed by chunk extensions, which are ignored.*/
+	static bool ParseChunkSize(const unsigned char *Begin, const unsigned char *End, unsigned long long &OutSize);
 };
 
 };
@@ -2,32 +2,51 @@
 
 #include <list>
 #include <utility>
+#include <atomic>
+#include <chrono>
 
 #include <boost/asio.hpp>
 
+#include "Common/TimingWheel.h"
+
 #include "IRespSource.h"
+#include "IConnManager.h"
 
 namespace HTTP
 {
 
 class IServerLog;
 
-class ConnectionBase
+/**Base class of the connections. The server keeps the connections scheduled in a timing wheel, through the
+TimingWheelNode base.*/
+class ConnectionBase : public UD::Comm::TimingWheelNode
 {
 public:
-	inline ConnectionBase(boost::asio::io_context &MyIOS) : MySock(MyIOS), ResponseCount(0) { }
-	inline ConnectionBase(boost::asio::ip::tcp::socket &&SrcSocket) : MySock(std::move(SrcSocket)), ResponseCount(0) { }
+	inline ConnectionBase(boost::asio::io_context &MyIOS) : MySock(MyIOS), ResponseCount(0), MyManager(nullptr) { }
+	inline ConnectionBase(boost::asio::ip::tcp::socket &&SrcSocket) : MySock(std::move(SrcSocket)), ResponseCount(0), MyManager(nullptr) { }
 	virtual ~ConnectionBase()
 	{
 		try { MySock.close(); }
 		catch (...) { }
 	}
 
-	virtual void Start(IRespSource *NewRespSource, IServerLog *NewLog)=0;
+	virtual void Start(IServerLog *NewLog)=0;
 	/**Closes the connection socket.*/
 	virtual void Stop()=0;
-	/**@return False, if the connection is closed, and it should be deleted.*/
-	virtual bool OnStep(unsigned int StepInterval, ConnectionBase **OutNextConn)=0;
+	/**Called by the server when the connection's timer expires. Note that this may be called from a different thread
+	than the connection's own handlers. When the connection is finished, it must notify its IConnManager, instead of
+	relying on this call.
+	@param Now The current time.
+	@return Time until the next call.*/
+	virtual std::chrono::steady_clock::duration OnTimer(std::chrono::steady_clock::time_point Now)=0;
+
+	/**Prepares the finished connection to be reused for a new client, retaining it's allocated buffers.
+	@return False, if the connection can't be reused, and it must be deleted instead.*/
+	virtual bool Reset() { return false; }
+
+	/**Sets the object, which will be notified about the connection's events. Must be called before Start(), and before the
+	first OnTimer() call.*/
+	inline void SetManager(IConnManager *NewManager) { MyManager=NewManager; }
 
 	inline boost::asio::ip::tcp::socket &GetSocket() { return MySock; }
 	inline boost::asio::ip::tcp::socket &&MoveSocket() { return std::move(MySock); }
@@ -36,7 +55,8 @@ public:
 protected:
 	boost::asio::ip::tcp::socket MySock;
 
-	unsigned int ResponseCount;
+	std::atomic_uint ResponseCount;
+	IConnManager *MyManager;
 };
 
 };
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+
 namespace HTTP
 {
 
@@ -12,7 +14,11 @@ struct Connection
 	unsigned int MaxHeadersLength = 4 * 1024;
 	unsigned int MaxPostBodyLength = 16 * 1024 * 1024;
 
-	unsigned int MaxSilentTime = 30;
+	std::chrono::steady_clock::duration MaxSilentTime = std::chrono::seconds(30);
+
+	/**If true, keep-alive connections waiting for the next request release their protocol handler coroutine and
+	read/write buffers, and only wait for the socket to become readable.*/
+	bool ReleaseIdleBuffers = false;
 };
 
 } //Config
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <stdint.h>
+#include <memory>
 #include <boost/filesystem.hpp>
 
 namespace HTTP
 {
 
+class AsyncFileWriter;
+
 namespace Config
 {
 
@@ -25,6 +28,17 @@ struct FileUpload
 	/**Maximum cumulative uploaded file size. If the total size of all uploaded files grow beyond this limit, the
 	parsing will be aborted.*/
 	uintmax_t MaxTotalUploadSize;
+
+	/**If set, the uploaded files are written by the threads of this writer, instead of the I/O threads of the server.
+	The connections stop reading the request body while too much data is queued, and wait for the files to be written
+	before creating the response. The writer can be shared between servers.*/
+	std::shared_ptr<AsyncFileWriter> Writer;
+	/**If true, the disk space of the uploaded files is allocated up front (up to the remaining length of the request
+	body, if it's known), to avoid fragmentation. Only used with Writer, on Linux.*/
+	bool PreallocateFiles = false;
+	/**If true, the uploaded files are written bypassing the page cache (with O_DIRECT), so large uploads don't evict
+	cached content. Only used with Writer, on file systems which support it.*/
+	bool DirectIO = false;
 };
 
 } //Config
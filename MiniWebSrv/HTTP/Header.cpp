@@ -1,7 +1,11 @@
 #include "Header.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "Common/StringUtils.h"
 #include "Common/TimeUtils.h"
+#include "Common/CharScan.h"
 
 using namespace HTTP;
 
@@ -182,8 +186,89 @@ const std::string ContentDisposExtractor::NameKey="name", ContentDisposExtractor
 
 const std::string Header::BoundaryParamName("boundary");
 
-std::unordered_map<std::string,HEADERNAME> Header::HeaderNameMap;
-bool Header::IsHeaderNameInit=Header::InitHeaderNameMap();
+namespace
+{
+
+struct HeaderNameEntry
+{
+	const char *Name;
+	unsigned int Length;
+};
+
+template<unsigned int N>
+constexpr HeaderNameEntry MakeHeaderName(const char (&Name)[N]) { return HeaderNameEntry{ Name, N-1 }; }
+
+/**The names of the HEADERNAME values, indexed by the value.*/
+constexpr HeaderNameEntry HeaderNameA[]=
+{
+	MakeHeaderName(""), //HN_UNKNOWN
+	MakeHeaderName("host"),
+	MakeHeaderName("connection"),
+	MakeHeaderName("content-disposition"),
+	MakeHeaderName("content-type"),
+	MakeHeaderName("content-length"),
+	MakeHeaderName("content-encoding"),
+	MakeHeaderName("user-agent"),
+	MakeHeaderName("if-modified-since"),
+	MakeHeaderName("origin"),
+	MakeHeaderName("upgrade"),
+	MakeHeaderName("sec-websocket-key"),
+	MakeHeaderName("sec-websocket-version"),
+	MakeHeaderName("sec-websocket-protocol"),
+	MakeHeaderName("last-modified"),
+	MakeHeaderName("location"),
+	MakeHeaderName("sec-websocket-accept"),
+	MakeHeaderName("access-control-request-method"),
+	MakeHeaderName("access-control-request-headers"),
+	MakeHeaderName("range"),
+	MakeHeaderName("if-range"),
+	MakeHeaderName("content-range"),
+	MakeHeaderName("accept-ranges"),
+	MakeHeaderName("accept-encoding"),
+	MakeHeaderName("vary"),
+	MakeHeaderName("transfer-encoding"),
+	MakeHeaderName("expect"),
+};
+
+static_assert(sizeof(HeaderNameA)/sizeof(HeaderNameA[0])==HN_NOTUSED, "Every HEADERNAME value must have a name in HeaderNameA.");
+
+/**Perfect hash of the header names, computed from the length, and the first, middle and last characters. If a new
+header name causes a collision, the static_assert below fails: change the multipliers (or the table size) then.*/
+const unsigned int HeaderHashSize = 64;
+const unsigned int HeaderHashLengthMul = 1, HeaderHashFirstMul = 30, HeaderHashLastMul = 60;
+
+constexpr unsigned int HashHeaderName(const char *Name, std::size_t Length)
+{
+	return (unsigned int)(Length*HeaderHashLengthMul + (unsigned char)Name[0]*HeaderHashFirstMul +
+		(unsigned char)Name[Length-1]*HeaderHashLastMul + (unsigned char)Name[Length/2]) & (HeaderHashSize-1);
+}
+
+struct HeaderHashTable
+{
+	unsigned char SlotA[HeaderHashSize]; //HEADERNAME values, or HN_UNKNOWN for empty slots.
+	bool IsPerfect;
+};
+
+constexpr HeaderHashTable BuildHeaderHashTable()
+{
+	HeaderHashTable RetVal={ {}, true };
+	for (unsigned int x=HN_UNKNOWN + 1; x!=HN_NOTUSED; ++x)
+	{
+		unsigned int Hash=HashHeaderName(HeaderNameA[x].Name,HeaderNameA[x].Length);
+		if (RetVal.SlotA[Hash]!=HN_UNKNOWN)
+			RetVal.IsPerfect=false;
+
+		RetVal.SlotA[Hash]=(unsigned char)x;
+	}
+
+	return RetVal;
+}
+
+constexpr HeaderHashTable HeaderHashT=BuildHeaderHashTable();
+static_assert(HeaderHashT.IsPerfect, "Header name hash collision: change the multipliers of HashHeaderName().");
+static_assert(HN_NOTUSED<=256, "HEADERNAME values must fit in the hash table slots.");
+
+};
 
 Header::Header(char *LineBegin, char *LineEnd)
 {
@@ -198,6 +283,24 @@ Header::Header(char *LineBegin, char *LineEnd, SkipParseOption) : IntName(HN_UNK
 	ExtractHeader(LineBegin,LineEnd,(char **)&Name,(char **)&Value);
 }
 
+Header::Header(char *LineBegin, char *NameEnd, char *LineEnd) : Name(LineBegin), Value(nullptr), IntName(HN_UNKNOWN)
+{
+	if (LineEnd[-1]=='\r')
+		--LineEnd;
+
+	*LineEnd='\0';
+	if (NameEnd)
+	{
+		IntName=ParseHeader(Name,NameEnd-LineBegin);
+
+		*NameEnd++='\0';
+		while ((NameEnd!=LineEnd) && (*NameEnd==' '))
+			++NameEnd;
+
+		Value=NameEnd;
+	}
+}
+
 CONTENTTYPE Header::GetContentType(std::string &OutBoundary) const
 {
 	if (IntName!=HN_CONTENT_TYPE)
@@ -239,6 +342,48 @@ bool Header::IsConnectionClose() const
 	return strcmp(Value,"close")==0;
 }
 
+bool Header::IsEncodingAccepted(const char *Coding) const
+{
+	//Sample: "gzip;q=1.0, identity; q=0.5, *;q=0"
+	int CodingQ=-1, AnyQ=-1; //-1: not listed, 0: not accepted, 1: accepted.
+	const char *CurrPos=Value;
+	while (*CurrPos)
+	{
+		while ((UD::StringUtils::IsSpace(*CurrPos)) || (*CurrPos==','))
+			++CurrPos;
+
+		const char *TokenBegin=CurrPos;
+		while ((*CurrPos) && (*CurrPos!=',') && (*CurrPos!=';') && (!UD::StringUtils::IsSpace(*CurrPos)))
+			++CurrPos;
+		const char *TokenEnd=CurrPos;
+
+		int CurrQ=1;
+		while ((*CurrPos) && (*CurrPos!=','))
+		{
+			if (*CurrPos==';')
+			{
+				++CurrPos;
+				while (UD::StringUtils::IsSpace(*CurrPos))
+					++CurrPos;
+
+				if (((*CurrPos=='q') || (*CurrPos=='Q')) && (CurrPos[1]=='='))
+					CurrQ=strtod(CurrPos+2,nullptr)>0 ? 1 : 0;
+			}
+			else
+				++CurrPos;
+		}
+
+		if (TokenBegin==TokenEnd)
+			continue;
+		else if ((TokenEnd-TokenBegin==1) && (*TokenBegin=='*'))
+			AnyQ=CurrQ;
+		else if (UD::StringUtils::CmpI(Coding,TokenBegin,TokenEnd)==0)
+			CodingQ=CurrQ;
+	}
+
+	return CodingQ!=-1 ? CodingQ==1 : AnyQ==1;
+}
+
 time_t Header::GetDateTime() const
 {
 	//                       0         1         2
@@ -338,57 +483,49 @@ unsigned long long Header::GetULongLong() const
 
 HEADERNAME Header::ParseHeader(const char *Name)
 {
-	std::unordered_map<std::string,HEADERNAME>::const_iterator FindI=HeaderNameMap.find(Name);
-	if (FindI!=HeaderNameMap.end())
-		return FindI->second;
+	return ParseHeader(Name,strlen(Name));
+}
+
+HEADERNAME Header::ParseHeader(const char *Name, std::size_t Length)
+{
+	if (!Length)
+		return HN_UNKNOWN;
+
+	HEADERNAME RetVal=(HEADERNAME)HeaderHashT.SlotA[HashHeaderName(Name,Length)];
+	const HeaderNameEntry &Entry=HeaderNameA[RetVal];
+	if ((Entry.Length==Length) && (memcmp(Entry.Name,Name,Length)==0))
+		return RetVal;
 	else
 		return HN_UNKNOWN;
 }
 
 const std::string &Header::GetHeaderName(HEADERNAME Name)
 {
-	switch (Name)
+	struct NameStrings
 	{
-	case HN_HOST: { static const std::string HeaderStr("host"); return HeaderStr; }
-	case HN_CONNECTION: { static const std::string HeaderStr("connection"); return HeaderStr; }
-	case HN_CONTENT_DISPOSITION: { static const std::string HeaderStr("content-disposition"); return HeaderStr; }
-	case HN_CONTENT_TYPE: { static const std::string HeaderStr("content-type"); return HeaderStr; }
-	case HN_CONTENT_LENGTH: { static const std::string HeaderStr("content-length"); return HeaderStr; }
-	case HN_CONTENT_ENCODING: { static const std::string HeaderStr("content-encoding"); return HeaderStr; }
-	case HN_USER_AGENT: { static const std::string HeaderStr("user-agent"); return HeaderStr; }
-	case HN_IF_MOD_SINCE: { static const std::string HeaderStr("if-modified-since"); return HeaderStr; }
-	case HH_ORIGIN: { static const std::string HeaderStr("origin"); return HeaderStr; }
-	case HH_UPGRADE: { static const std::string HeaderStr("upgrade"); return HeaderStr; }
-	case HH_SEC_WEBSOCKET_KEY: { static const std::string HeaderStr("sec-websocket-key"); return HeaderStr; }
-	case HH_SEC_WEBSCOKET_VERSION: { static const std::string HeaderStr("sec-websocket-version"); return HeaderStr; }
-	case HH_SEC_WEBSOCKET_PROTOCOL: { static const std::string HeaderStr("sec-websocket-protocol"); return HeaderStr; }
-	case HN_LAST_MODIFIED: { static const std::string HeaderStr("last-modified"); return HeaderStr; }
-	case HN_LOCATION: { static const std::string HeaderStr("location"); return HeaderStr; }
-	case HH_SEC_WEBSOCKET_ACCEPT: { static const std::string HeaderStr("sec-websocket-accept"); return HeaderStr; }
-	case HN_ACCESS_CONTROL_REQUEST_METHOD: { static const std::string HeaderStr("access-control-request-method"); return HeaderStr; }
-	case HN_ACCESS_CONTROL_REQUEST_HEADERS: { static const std::string HeaderStr("access-control-request-headers"); return HeaderStr; }
-	default: { static const std::string HeaderStr(""); return HeaderStr; }
-	}
+		NameStrings()
+		{
+			for (unsigned int x=HN_UNKNOWN; x!=HN_NOTUSED; ++x)
+				StrA[x].assign(HeaderNameA[x].Name,HeaderNameA[x].Length);
+		}
+
+		std::string StrA[HN_NOTUSED];
+	};
+
+	static const NameStrings Names;
+	return (unsigned int)Name<HN_NOTUSED ? Names.StrA[Name] : Names.StrA[HN_UNKNOWN];
 }
 
 char *Header::ExtractHeader(char *LineBegin, char *LineEnd, char **OutName, char **OutValue)
 {
 	*OutName=LineBegin;
 	*OutValue=nullptr;
-	while (LineBegin!=LineEnd)
-	{
-		char CurrVal=*LineBegin;
-		if ((CurrVal>='A') && (CurrVal<='Z'))
-			*LineBegin=CurrVal-'A'+'a';
-		else if (CurrVal==':')
-		{
-			*LineBegin='\0';
-			LineBegin++;
-			break;
-		}
 
-		LineBegin++;
-	}
+	char *NameEnd=(char *)UD::CharScan::Find((unsigned char *)LineBegin,(unsigned char *)LineEnd,':');
+	UD::CharScan::ToLower((unsigned char *)LineBegin,(unsigned char *)NameEnd);
+	LineBegin=NameEnd;
+	if (LineBegin!=LineEnd)
+		*LineBegin++='\0';
 
 	while (LineBegin!=LineEnd)
 	{
@@ -423,11 +560,3 @@ void Header::FormatDateTime(time_t Timestamp, char *TargetBuff)
 	else
 		*TargetBuff='\0';
 }
-
-bool Header::InitHeaderNameMap()
-{
-	for (unsigned int x=HN_UNKNOWN + 1; x!=HN_NOTUSED; ++x)
-		AddToHeaderMap((HEADERNAME)x);
-
-	return true;
-}
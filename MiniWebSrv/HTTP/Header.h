@@ -4,11 +4,10 @@
 #include <string>
 #include <stdexcept>
 
-#include <unordered_map>
-
 namespace HTTP
 {
 
+/**Header names recognized by the parser. When adding a new value, add its name to HeaderNameA in Header.cpp, too.*/
 enum HEADERNAME
 {
 	HN_UNKNOWN,
@@ -31,6 +30,14 @@ enum HEADERNAME
 	HH_SEC_WEBSOCKET_ACCEPT,
 	HN_ACCESS_CONTROL_REQUEST_METHOD,
 	HN_ACCESS_CONTROL_REQUEST_HEADERS,
+	HN_RANGE,
+	HN_IF_RANGE,
+	HN_CONTENT_RANGE,
+	HN_ACCEPT_RANGES,
+	HN_ACCEPT_ENCODING,
+	HN_VARY,
+	HN_TRANSFER_ENCODING,
+	HN_EXPECT,
 
 	HN_NOTUSED,
 };
@@ -52,6 +59,11 @@ struct Header
 	inline Header() : Name(nullptr), Value(nullptr) { }
 	Header(char *LineBegin, char *LineEnd);
 	Header(char *LineBegin, char *LineEnd, SkipParseOption);
+	/**Creates a header from an already scanned line.
+	@param NameEnd The position of the colon after the (already lowercased) header name, or nullptr, if the line
+		doesn't have one.
+	@param LineEnd The position of the '\n' at the end of the line.*/
+	Header(char *LineBegin, char *NameEnd, char *LineEnd);
 
 	class FormatException : public std::runtime_error
 	{
@@ -70,6 +82,9 @@ struct Header
 	CONTENTTYPE GetContentType(std::string &OutBoundary) const;
 	void ParseContentDisposition(std::string &OutName, std::string &OutFileName, bool &OutFileNameExists) const;
 	bool IsConnectionClose() const;
+	/**Parses the header value, as if it were an Accept-Encoding list.
+	@return True, if the given content coding is accepted: it's listed (or "*" is listed) with a non-zero q-value.*/
+	bool IsEncodingAccepted(const char *Coding) const;
 	/**Parses the header value, as if were a http-date.
 	@throw FormatException
 	@return The parsed timestamp.*/
@@ -80,6 +95,8 @@ struct Header
 	unsigned long long GetULongLong() const;
 
 	static HEADERNAME ParseHeader(const char *Name);
+	/**Classifies a lowercase header name, without allocating memory.*/
+	static HEADERNAME ParseHeader(const char *Name, std::size_t Length);
 	static const std::string &GetHeaderName(HEADERNAME Name);
 	static char *ExtractHeader(char *LineBegin, char *LineEnd, char **OutName, char **OutValue);
 
@@ -88,11 +105,6 @@ struct Header
 
 private:
 	static const std::string BoundaryParamName;
-
-	static bool IsHeaderNameInit;
-	static std::unordered_map<std::string,HEADERNAME> HeaderNameMap;
-	static bool InitHeaderNameMap();
-	static inline void AddToHeaderMap(HEADERNAME Name) { HeaderNameMap[GetHeaderName(Name)]=Name; }
 };
 
 };
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory>
+
+namespace HTTP
+{
+
+class ConnectionBase;
+class IRespSource;
+
+/**Interface of the object which owns the connections (the server). The methods can be called from any thread.*/
+class IConnManager
+{
+public:
+	virtual ~IConnManager() { }
+
+	/**Called by a connection when it has finished, and can be deleted. This must be the last access of the connection
+	to itself: the manager might delete it immediately.
+	@param NextConn The connection which continues the finished one after a protocol upgrade, or nullptr.*/
+	virtual void OnConnectionFinished(ConnectionBase *Conn, ConnectionBase *NextConn)=0;
+	/**Called by a connection after it has sent a response.*/
+	virtual void OnResponseFinished(ConnectionBase *Conn)=0;
+	/**@return The current response source. It may be replaced at any time, so it's requested again for every request,
+	and kept alive until the response is finished.*/
+	virtual std::shared_ptr<IRespSource> GetRespSource()=0;
+};
+
+};
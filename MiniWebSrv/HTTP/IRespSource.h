@@ -40,6 +40,21 @@ public:
 	The default implementation is a stub.*/
 	virtual void SetServerLog(IServerLog *NewLog) { }
 
+	/**Called for POST requests with an URL encoded or unknown type body, after the headers were parsed. If it returns true,
+	the body isn't buffered by the connection: Create() is called before reading it (with an empty content buffer), then
+	the body is passed to IResponse::OnBodyData() of the new response in chunks, as it arrives. URL encoded bodies aren't
+	added to the query parameters then, and the body length isn't limited by Config::Connection::MaxPostBodyLength.
+	The default implementation returns false.*/
+	virtual bool IsBodyStreamed(METHOD Method, const std::string &Resource, const std::vector<Header> &HeaderA) { return false; }
+
+	/**Called for requests with an "Expect: 100-continue" header, before their body is read. These clients wait for a
+	"100 Continue" interim response before sending the body, so the request can be rejected based on it's headers,
+	without transferring the body.
+	@return nullptr to accept the body (the default implementation), or the final response of the request (for example,
+		401 or 413). The body isn't read then, and the connection is closed after the response.*/
+	virtual IResponse *OnExpectContinue(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
+		AsyncHelperHolder AsyncHelpers, void *ParentConn) { return nullptr; }
+
 	/**Creates a new IResponse object, which will be used to generate the response. The objects passed to this method
 	can be modified, and will stay valid until the returned object is destroyed.*/
 	virtual IResponse *Create(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <memory>
+
+#include <boost/asio/buffer.hpp>
 #include <boost/asio/spawn.hpp>
 
+#include "Common/FileUtils.h"
+
 #include "Common.h"
 #include "Header.h"
 
@@ -29,6 +34,30 @@ public:
 	/**@return True, if the response is finished.*/
 	virtual bool Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength,
 		boost::asio::yield_context &Ctx)=0;
+	/**Queries an open file, which contains the whole response. If the platform supports it, the response will be sent
+	directly from this file to the socket (with sendfile()), instead of calling Read(). Only used, if the length of the
+	response is known.
+	@param OutFile The file. It's owned by the response object.
+	@param OutOffset The position of the response in the file.
+	@return False, if the response can only be read with Read().*/
+	virtual bool GetContentFile(UD::FileUtils::FileHandle &OutFile, unsigned long long &OutOffset) { return false; }
+	/**Maximum number of buffers returned by GetContentBuffers().*/
+	static const unsigned int MaxContentBufferCount = 4;
+	/**Queries memory buffers, which contain the whole response, in order. The response will be queued for writing directly
+	from these buffers, instead of calling Read(). Only used, if the length of the response is known.
+	@param OutBuffA Receives at most MaxContentBufferCount buffers. They must stay valid while OutOwner is referenced,
+		even after the response object is deleted.
+	@param OutOwner The owner of the buffers.
+	@return The number of buffers, or 0, if the response can only be read with Read().*/
+	virtual unsigned int GetContentBuffers(boost::asio::const_buffer *OutBuffA, std::shared_ptr<const void> &OutOwner) { return 0; }
+
+	/**Receives the next part of the request body, if it's streamed (see IRespSource::IsBodyStreamed()). The response is
+	only sent after the whole body was passed to this method. The connection doesn't read the rest of the body until it
+	returns, so it can yield on Ctx, to process the data asynchronously.
+	@param Begin The data is only valid during this call.
+	@return False to stop reading the body: the response is sent right away, and the connection is closed after it.
+		The default implementation rejects the body.*/
+	virtual bool OnBodyData(const unsigned char *Begin, const unsigned char *End, boost::asio::yield_context &Ctx) { return false; }
 
 	/**Upgrades the specified connection to another type.
 	This method will be called after the response was successfully sent.
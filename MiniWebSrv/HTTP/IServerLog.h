@@ -10,6 +10,7 @@
 namespace HTTP
 {
 
+/**Server log interface. Note that the methods can be called concurrently from the server's worker threads.*/
 class IServerLog
 {
 public:
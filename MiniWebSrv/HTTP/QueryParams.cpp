@@ -1,6 +1,7 @@
 #include "QueryParams.h"
 
 #include "Header.h"
+#include "Common/CharScan.h"
 
 namespace HTTP
 {
@@ -170,95 +171,84 @@ bool QueryParams::AddURLEncoded(const char *Begin, const char *End)
 
 bool QueryParams::AppendFormMultipart(const char *Begin, const char *End)
 {
-/*Continous boundary detection:
-	set content start to start of the input data
-	for each input character:
-		if the current char equals to the parse position in the boundary string:
-			advance the parse position
-			if the boundary string is fully matched:
-				we have content from content start to the start of the boundary string.
-				if the boundary string starts after the end of the input data:
-					the bytes in [start of content, start of boundary) are content
-				reset the parse position
-				set content start to current position + 1
-		otherwise:
-			the bytes in temporary data are content
-			reset the parse position
-			clear the temporary data storage
-	save the parse position
-	the bytes [content start, end-parse position) are content
-	store the bytes [end-parse position, end) as temporary data*/
+/*Continous boundary detection. The boundary string ("\r\n--" and the boundary parameter) only contains '\r' as it's
+first character, so after a failed match, the search can continue from the mismatching character:
+	if a boundary match is pending from the previous data:
+		compare the rest of the boundary string with the start of the input data
+		if it's fully matched, start a new part after it
+		if the input data ended before the mismatch, keep the match pending
+		otherwise, the bytes in temporary data are content
+	until the end of the input data:
+		find the next '\r' (vectorized)
+		compare the boundary string from there
+		if it's fully matched:
+			the bytes from content start to the start of the boundary string are content
+			start a new part, and set content start to the end of the boundary string
+		if the input data ends inside the boundary string:
+			the bytes from content start to the start of the boundary string are content
+			store the rest of the bytes as temporary data, and save the parse position
+	the bytes [content start, end) are content*/
 
 	const char *Pos=Begin, *ContentBegin=Begin;
-	while (Pos!=End)
+	const std::size_t BoundaryLength=BoundaryStr.length();
+
+	if (BoundaryParseCounter)
 	{
-		if (!BoundaryParseCounter)
+		std::size_t MatchLength=std::min<std::size_t>(BoundaryLength-BoundaryParseCounter,End-Begin);
+		if (memcmp(Begin,BoundaryStr.data()+BoundaryParseCounter,MatchLength)!=0)
 		{
-			while (Pos!=End)
-			{
-				if (*Pos!='\r')
-					++Pos;
-				else
-				{
-					++Pos;
-					BoundaryParseCounter=1;
-					break;
-				}
-			}
-
-			if (Pos==End)
-				break;
+			//Match broken. The currently kept ParseTmp is actually content.
+			AppendToCurrentPart(ParseTmp.data(), ParseTmp.data() + ParseTmp.size());
+			ParseTmp.clear();
+			BoundaryParseCounter=0;
 		}
-
-		if (*Pos==BoundaryStr[BoundaryParseCounter])
+		else if (BoundaryParseCounter+MatchLength<BoundaryLength)
 		{
-			//Boundary match; advance the test position.
-			++BoundaryParseCounter;
-			++Pos;
-			if (BoundaryParseCounter==BoundaryStr.length())
-			{
-				//Full boundary match. The currently kept ParseTmp might contain content.
-				if ((unsigned int)(Pos-Begin)<BoundaryParseCounter)
-				{
-					const char *TmpBoundaryStart=(ParseTmp.data()+ParseTmp.length()) - (BoundaryParseCounter-(Pos-Begin));
-					if (TmpBoundaryStart>ParseTmp.data())
-						AppendToCurrentPart(ParseTmp.data(), TmpBoundaryStart);
-				}
-				else if (ContentBegin<Pos-BoundaryParseCounter)
-					AppendToCurrentPart(ContentBegin, Pos-BoundaryParseCounter);
-
-				BoundaryParseCounter=0;
-				ParseTmp.clear();
-				ContentBegin=Pos;
-				StartNewPart();
-			}
+			//The input data ended before the end of the boundary string.
+			ParseTmp.append(Begin,End);
+			BoundaryParseCounter+=(unsigned int)MatchLength;
+			return true;
 		}
-		else if (BoundaryParseCounter)
+		else
 		{
-			//Match broken.
-			if (!ParseTmp.empty())
-			{
-				//The currently kept ParseTmp is actually content.
-				AppendToCurrentPart(ParseTmp.data(), ParseTmp.data() + ParseTmp.size());
-				ParseTmp.clear();
-			}
-
-			AppendToCurrentPart(ContentBegin, Pos);
-			BoundaryParseCounter=0;
+			//Full boundary match.
+			Pos+=MatchLength;
 			ContentBegin=Pos;
+			BoundaryParseCounter=0;
+			ParseTmp.clear();
+			StartNewPart();
 		}
-		else
-			++Pos;
 	}
 
-	if (BoundaryParseCounter)
+	while (true)
 	{
-		AppendToCurrentPart(ContentBegin, Pos-BoundaryParseCounter);
-		ParseTmp.append(std::max(Pos-BoundaryParseCounter, Begin), Pos);
-	}
-	else if (Pos!=Begin)
+		Pos=(const char *)UD::CharScan::Find((const unsigned char *)Pos,(const unsigned char *)End,'\r');
+		if (Pos==End)
+			break;
+
+		std::size_t MatchLength=std::min<std::size_t>(BoundaryLength,End-Pos);
+		if (memcmp(Pos,BoundaryStr.data(),MatchLength)!=0)
+		{
+			++Pos;
+			continue;
+		}
+
 		AppendToCurrentPart(ContentBegin, Pos);
+		if (MatchLength<BoundaryLength)
+		{
+			//The input data ends inside a possible boundary: the next call decides, whether it's content.
+			ParseTmp.assign(Pos,End);
+			BoundaryParseCounter=(unsigned int)MatchLength;
+			return true;
+		}
+
+		//Full boundary match.
+		Pos+=BoundaryLength;
+		ContentBegin=Pos;
+		StartNewPart();
+	}
 
+	AppendToCurrentPart(ContentBegin, End);
 	return true;
 }
 
@@ -382,13 +372,19 @@ bool QueryParams::AppendToCurrentPart(const char *Begin, const char *End)
 			}
 			break;
 		case STATE_HEADERS_END:
-			if (CurrVal=="\r\n\r\n"[FMParseCounter])
+			if ((!FMParseCounter) && (CurrVal!='\r'))
+			{
+				//Skip to the next possible end of the headers.
+				Begin=(const char *)UD::CharScan::Find((const unsigned char *)Begin,(const unsigned char *)End,'\r');
+				continue;
+			}
+			else if (CurrVal=="\r\n\r\n"[FMParseCounter])
 			{
 				if (++FMParseCounter==4)
 				{
 					//End of headers found.
-					if (Begin-OrigBegin-4>0)
-						HeaderParseTmp.append(OrigBegin,Begin+1);
+					//The beginning of the headers might be in HeaderParseTmp already, from the previous data.
+					HeaderParseTmp.append(OrigBegin,Begin+1);
 
 					if (ParseFMHeaders(HeaderParseTmp.data(),HeaderParseTmp.data()+HeaderParseTmp.length()))
 					{
@@ -481,8 +477,7 @@ bool QueryParams::ParseFMHeaders(const char *HeadersBegin, const char *HeadersEn
 				if (!CurrFMPart.TargetFile->Path.empty())
 				{
 					//We've already read a file with this name. Delete the previous file's temp data.
-					boost::system::error_code DelErr;
-					boost::filesystem::remove(CurrFMPart.TargetFile->Path, DelErr);
+					UploadHelper->OnFileReplaced(CurrFMPart.TargetFile->Path);
 				}
 
 				CurrFMPart.TargetFile->MimeType=ContentTypeVal ? ContentTypeVal : UnknownFileContentType;
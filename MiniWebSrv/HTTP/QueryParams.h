@@ -32,6 +32,13 @@ public:
 		virtual std::tuple<boost::filesystem::path, bool> OnNewFile(const std::string &Name, const std::string &OrigFileName, const std::string &MimeType)=0;
 		virtual bool OnFileData(const char *Begin, const char *End)=0;
 		virtual void OnFileEnd()=0;
+		/**Called when a file is replaced by a later file with the same name, in the same request. The default
+		implementation deletes it.*/
+		virtual void OnFileReplaced(const boost::filesystem::path &Path)
+		{
+			boost::system::error_code DelErr;
+			boost::filesystem::remove(Path,DelErr);
+		}
 	};
 
 	QueryParams();
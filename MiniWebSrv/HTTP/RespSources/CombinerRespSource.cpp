@@ -46,17 +46,60 @@ void Combiner::SetServerLog(IServerLog *NewLog)
 		CurrHolder.RespSource->SetServerLog(NewLog);
 }
 
+bool Combiner::IsBodyStreamed(METHOD Method, const std::string &Resource, const std::vector<Header> &HeaderA)
+{
+	std::string Res;
+	const RewHolder *Redirect;
+	if (const RSHolder *Target=Route(Resource,Res,Redirect))
+		return Target->RespSource->IsBodyStreamed(Method, Res, HeaderA);
+	else
+		return false;
+}
+
+IResponse *Combiner::OnExpectContinue(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
+	AsyncHelperHolder AsyncHelpers, void *ParentConn)
+{
+	//Redirects are sent by Create(), after the body.
+	std::string Res;
+	const RewHolder *Redirect;
+	if (const RSHolder *Target=Route(Resource,Res,Redirect))
+		return Target->RespSource->OnExpectContinue(Method, Res, Query, HeaderA, AsyncHelpers, ParentConn);
+	else
+		return nullptr;
+}
+
 IResponse *Combiner::Create(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
 	unsigned char *ContentBuff, unsigned char *ContentBuffEnd,
 	AsyncHelperHolder AsyncHelpers, void *ParentConn)
 {
+	std::string Res;
+	const RewHolder *Redirect;
+	if (const RSHolder *Target=Route(Resource,Res,Redirect))
+	{
+		return Target->RespSource->Create(Method, Res,
+			Query, HeaderA, ContentBuff, ContentBuffEnd,
+			AsyncHelpers, ParentConn);
+	}
+	else if (Redirect)
+		return new RedirectResponse(Redirect->Target,Redirect->IsPermanentRedirect);
+	else
+		return new CommonError::Response(Res,HeaderA,NULL,RC_NOTFOUND);
+}
+
+const Combiner::RSHolder *Combiner::Route(const std::string &Resource, std::string &OutResource, const RewHolder *&OutRedirect) const
+{
+	OutRedirect=nullptr;
+
 	const std::string *ResPtr=&Resource;
 	{
 		std::unordered_map<std::string,RewHolder>::const_iterator FindI=RewMap.find(*ResPtr);
 		if (FindI!=RewMap.end())
 		{
 			if (FindI->second.IsRedirect)
-				return new RedirectResponse(FindI->second.Target,FindI->second.IsPermanentRedirect);
+			{
+				OutRedirect=&FindI->second;
+				return nullptr;
+			}
 			else
 				ResPtr=&(FindI->second.Target);
 		}
@@ -66,14 +109,13 @@ IResponse *Combiner::Create(METHOD Method, std::string &Resource, QueryParams &Q
 	{
 		if (CurrHolder(*ResPtr))
 		{
-			auto Res=ResPtr->substr(CurrHolder.Prefix.length());
-			return CurrHolder.RespSource->Create(Method, Res,
-				Query, HeaderA, ContentBuff, ContentBuffEnd,
-				AsyncHelpers, ParentConn);
+			OutResource=ResPtr->substr(CurrHolder.Prefix.length());
+			return &CurrHolder;
 		}
 	}
 
-	return new CommonError::Response(*ResPtr,HeaderA,NULL,RC_NOTFOUND);
+	OutResource=*ResPtr;
+	return nullptr;
 }
 
 }; //RespSource
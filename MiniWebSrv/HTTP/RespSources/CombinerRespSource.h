@@ -45,6 +45,10 @@ public:
 
 	virtual void SetServerLog(IServerLog *NewLog);
 
+	virtual bool IsBodyStreamed(METHOD Method, const std::string &Resource, const std::vector<Header> &HeaderA) override;
+	virtual IResponse *OnExpectContinue(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
+		AsyncHelperHolder AsyncHelpers, void *ParentConn) override;
+
 	virtual IResponse *Create(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
 		unsigned char *ContentBuff, unsigned char *ContentBuffEnd,
 		AsyncHelperHolder AsyncHelpers, void *ParentConn) override;
@@ -82,6 +86,13 @@ protected:
 
 	std::vector<RSHolder> HolderA;
 	std::unordered_map<std::string,RewHolder> RewMap;
+
+	/**Finds the source of a resource, after applying the rewrites.
+	@param OutResource Set to the resource passed to the source (without the prefix). If there's no matching source,
+		it's set to the rewritten resource.
+	@param OutRedirect Set to the redirect of the resource, or nullptr.
+	@return The matching source, or nullptr, if the resource is redirected, or there's no matching source.*/
+	const RSHolder *Route(const std::string &Resource, std::string &OutResource, const RewHolder *&OutRedirect) const;
 };
 
 }; //RespSource
@@ -62,6 +62,16 @@ bool CommonError::Response::Read(unsigned char *TargetBuff, unsigned int MaxLeng
 			RespCode,Res.data(),
 			Res.data());
 		break;
+	case RC_PAYLOADTOOLARGE:
+		OutLength=(unsigned int)sprint_safe((char *)TargetBuff,MaxLength,
+			"<head><title>Err: %d - %s</title></head>\n"
+			"<body>\n"
+			"<h1>413 Payload too large</h1>\n"
+			"The request body is too large for resource: <b>%s</b><br />\n"
+			"</body>",
+			RespCode,Res.data(),
+			Res.data());
+		break;
 	case RC_SERVERERROR:
 		OutLength=(unsigned int)sprint_safe((char *)TargetBuff,MaxLength,
 			"<head><title>Err: %d - %s</title></head>\n"
@@ -1,35 +1,99 @@
 #include "FSRespSource.h"
 
+#include <fstream>
 #include <type_traits>
 #include <stdexcept>
 
 #include <boost/locale.hpp>
 
+#include "../BuildConfig.h"
 #include "CommonErrorRespSource.h"
 #include "detail/MimeDB.h"
 
 using namespace HTTP;
 using namespace HTTP::RespSource;
 
-FS::Response::Response(const boost::filesystem::path &FileName, const char *MimeType, time_t IfModifiedSince) : MyMimeType(MimeType)
+const char *FS::Response::VaryValue="Accept-Encoding";
+const FS::PrecompressedType FS::PrecompressedA[detail::FSMetaCache::PrecompressedCount]={
+	{ ".br", "br" },
+	{ ".zst", "zstd" },
+	{ ".gz", "gzip" },
+};
+
+FS::Response::Response(const boost::filesystem::path &FileName, const char *MimeType, time_t IfModifiedSince,
+	const std::vector<Header> *RequestHeaderA) :
+#ifdef UD_SENDFILE_SUPPORTED
+	InFile(UD::FileUtils::InvalidFileHandle),
+#endif
+	MyMimeType(MimeType), ContentEncoding(nullptr), SendVary(false)
 {
 	time_t LastModTime=boost::filesystem::last_write_time(FileName);
 	Header::FormatDateTime(LastModTime,LastModifiedStr);
 
+	Init(FileName.string().data(),
+		(!IfModifiedSince) || (LastModTime>IfModifiedSince) ? boost::filesystem::file_size(FileName) : 0,
+		LastModTime,IfModifiedSince,RequestHeaderA);
+}
+
+FS::Response::Response(const detail::FSMetaCache::Entry &Meta, time_t IfModifiedSince,
+	const std::vector<Header> *RequestHeaderA, const detail::ContentCache::ContentPtr &Content,
+	const detail::FSMetaCache::Entry *EncodedMeta, const char *ContentEncoding) :
+	Content(Content),
+#ifdef UD_SENDFILE_SUPPORTED
+	InFile(UD::FileUtils::InvalidFileHandle),
+#endif
+	MyMimeType(Meta.MimeType), ContentEncoding(EncodedMeta ? ContentEncoding : nullptr), SendVary(false)
+{
+	memcpy(LastModifiedStr,Meta.LastModifiedStr,sizeof(LastModifiedStr));
+
+	for (const detail::FSMetaCache::EntryPtr &CurrPC : Meta.PrecompressedA)
+		SendVary|=(bool)CurrPC;
+
+	//The Last-Modified date of the file is used for it's precompressed siblings too.
+	const detail::FSMetaCache::Entry &SendMeta=EncodedMeta ? *EncodedMeta : Meta;
+	Init(SendMeta.PathStr.data(),SendMeta.Size,Meta.LastModTime,IfModifiedSince,RequestHeaderA);
+}
+
+void FS::Response::Init(const char *FileName, unsigned long long NewFileSize, time_t LastModTime, time_t IfModifiedSince,
+	const std::vector<Header> *RequestHeaderA)
+{
+	FilePos=0;
 	if ((!IfModifiedSince) || (LastModTime>IfModifiedSince))
 	{
-		FileSize=boost::filesystem::file_size(FileName);
-		FilePos=0;
+		FileSize=NewFileSize;
+
+		if (!Content)
+		{
+#ifdef UD_SENDFILE_SUPPORTED
+			InFile=UD::FileUtils::OpenRead(FileName);
+			if (InFile==UD::FileUtils::InvalidFileHandle)
+				throw std::runtime_error("Cannot open target file");
+#else
+			InS.open(FileName,std::ios_base::binary);
+			if (!InS.is_open())
+				throw std::runtime_error("Cannot open target file");
+#endif
+		}
 
-		InS.open(FileName.string().data(),std::ios_base::binary);
-		if (!InS.is_open())
-			throw std::runtime_error("Cannot open target file");
+		Ranges.Init(RequestHeaderA,FileSize,LastModifiedStr,MyMimeType);
 	}
 	else
-	{
 		FileSize=NotModifiedSize;
-		FilePos=0;
-	}
+}
+
+FS::Response::~Response()
+{
+	CloseStream();
+}
+
+void FS::Response::CloseStream()
+{
+#ifdef UD_SENDFILE_SUPPORTED
+	UD::FileUtils::Close(InFile);
+	InFile=UD::FileUtils::InvalidFileHandle;
+#else
+	InS.close();
+#endif
 }
 
 bool FS::Response::GetExtraHeader(unsigned int Index,
@@ -46,25 +110,59 @@ bool FS::Response::GetExtraHeader(unsigned int Index,
 
 		return true;
 	}
+	Index--;
+
+	if (ContentEncoding)
+	{
+		if (Index==0)
+		{
+			const std::string &HName=Header::GetHeaderName(HN_CONTENT_ENCODING);
+			*OutHeader=HName.data();
+			*OutHeaderEnd=HName.data() + HName.size();
+			*OutHeaderVal=ContentEncoding;
+			*OutHeaderValEnd=ContentEncoding + strlen(ContentEncoding);
+
+			return true;
+		}
+		Index--;
+	}
+
+	if (SendVary)
+	{
+		if (Index==0)
+		{
+			const std::string &HName=Header::GetHeaderName(HN_VARY);
+			*OutHeader=HName.data();
+			*OutHeaderEnd=HName.data() + HName.size();
+			*OutHeaderVal=VaryValue;
+			*OutHeaderValEnd=VaryValue + strlen(VaryValue);
+
+			return true;
+		}
+		Index--;
+	}
+
+	if (FileSize!=NotModifiedSize)
+		return Ranges.GetExtraHeader(Index,OutHeader,OutHeaderEnd,OutHeaderVal,OutHeaderValEnd);
 	else
 		return false;
 }
 
+const char *FS::Response::GetContentType() const
+{
+	if (const char *RangesType=Ranges.GetContentType())
+		return RangesType;
+	else
+		return MyMimeType;
+}
+
 bool FS::Response::Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength,
 		boost::asio::yield_context &Ctx)
 {
 	if (FileSize!=NotModifiedSize)
 	{
-		unsigned long long RemLength=FileSize-FilePos;
-		if (MaxLength>RemLength)
-			MaxLength=(unsigned int)RemLength;
-
-		InS.read((char *)TargetBuff,MaxLength);
-	
-		OutLength=MaxLength;
-		FilePos+=MaxLength;
-
-		return (FilePos==FileSize) || (InS.fail());
+		return Ranges.Read(TargetBuff,MaxLength,OutLength,
+			[this](unsigned long long Pos, unsigned char *Target, unsigned int Length) { return ReadAt(Pos,Target,Length); });
 	}
 	else
 	{
@@ -73,52 +171,253 @@ bool FS::Response::Read(unsigned char *TargetBuff, unsigned int MaxLength, unsig
 	}
 }
 
-FS::FS(const boost::filesystem::path &NewRoot) : Root(boost::filesystem::canonical(NewRoot))
+unsigned int FS::Response::ReadAt(unsigned long long Pos, unsigned char *TargetBuff, unsigned int Length)
+{
+	if (Content)
+	{
+		if (Pos>=Content->size())
+			return 0;
+		else if (Length>Content->size()-Pos)
+			Length=(unsigned int)(Content->size()-Pos);
+
+		memcpy(TargetBuff,Content->data()+Pos,Length);
+		FilePos=Pos+Length;
+		return Length;
+	}
+
+#ifdef UD_SENDFILE_SUPPORTED
+	long long ReadLength=UD::FileUtils::ReadAt(InFile,Pos,TargetBuff,Length);
+	if (ReadLength<=0)
+		//The file was truncated, or can't be read: the response will be incomplete.
+		return 0;
+#else
+	if (Pos!=FilePos)
+	{
+		InS.clear();
+		InS.seekg(Pos);
+	}
+
+	InS.read((char *)TargetBuff,Length);
+	std::streamsize ReadLength=InS.gcount();
+#endif
+
+	FilePos=Pos+ReadLength;
+	return (unsigned int)ReadLength;
+}
+
+bool FS::Response::GetContentFile(UD::FileUtils::FileHandle &OutFile, unsigned long long &OutOffset)
+{
+#ifdef UD_SENDFILE_SUPPORTED
+	unsigned long long RangeLength;
+	if ((FileSize!=NotModifiedSize) && (InFile!=UD::FileUtils::InvalidFileHandle) && (!FilePos) &&
+		(Ranges.GetSingleRange(OutOffset,RangeLength)))
+	{
+		OutFile=InFile;
+		return true;
+	}
+#endif
+
+	return false;
+}
+
+unsigned int FS::Response::GetContentBuffers(boost::asio::const_buffer *OutBuffA, std::shared_ptr<const void> &OutOwner)
+{
+	unsigned long long RangeBegin, RangeLength;
+	if ((FileSize!=NotModifiedSize) && (Content) && (!FilePos) && (Ranges.GetSingleRange(RangeBegin,RangeLength)) &&
+		(RangeBegin+RangeLength<=Content->size()))
+	{
+		OutBuffA[0]=boost::asio::const_buffer(Content->data()+RangeBegin,(std::size_t)RangeLength);
+		OutOwner=Content;
+		return 1;
+	}
+	else
+		return 0;
+}
+
+FS::FS(const boost::filesystem::path &NewRoot, unsigned long long ContentCacheSize) : Root(boost::filesystem::canonical(NewRoot))
 {
 	if (!Root.empty() && Root.filename_is_dot())
 		Root=Root.parent_path();
+
+	MyMetaCache.reset(new detail::FSMetaCache(Root,BuildConfig::FSMetaCacheSize));
+	if (ContentCacheSize)
+		MyContentCache.reset(new detail::ContentCache(ContentCacheSize));
 }
 
 IResponse *FS::Create(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
 		unsigned char *ContentBuff, unsigned char *ContentBuffEnd,
 		AsyncHelperHolder AsyncHelpers, void *ParentConn)
 {
-	boost::filesystem::path Target;
-	try
+	detail::FSMetaCache::EntryPtr Meta=MyMetaCache->Get(Resource);
+	if (!Meta)
 	{
-		if (std::is_same<boost::filesystem::path::value_type,wchar_t>())
-			Target=boost::filesystem::canonical(Root / boost::locale::conv::utf_to_utf<wchar_t,char>(Resource));
-		else
-			Target=boost::filesystem::canonical(Root / Resource);
+		Meta=LoadMeta(Resource);
+		if (!Meta)
+			return new CommonError::Response(Resource,HeaderA,NULL,RC_NOTFOUND);
+	}
+
+	if (Meta->IsDirectory)
+		return new CommonError::Response(Resource,HeaderA,NULL,RC_FORBIDDEN);
+
+	time_t IfModSinceTime=0;
+	const Header *AcceptEncodingH=nullptr;
+	for (const Header &CurrH : HeaderA)
+	{
+		if (CurrH.IntName==HN_IF_MOD_SINCE)
+		{
+			try { IfModSinceTime=CurrH.GetDateTime(); }
+			catch (...) { }
+		}
+		else if (CurrH.IntName==HN_ACCEPT_ENCODING)
+			AcceptEncodingH=&CurrH;
 	}
-	catch (...)
-	{ return new CommonError::Response(Resource,HeaderA,NULL,RC_NOTFOUND); }
 
-	if ( (std::distance(Root.begin(), Root.end())<=std::distance(Target.begin(), Target.end())) &&
-	  (std::equal(Root.begin(), Root.end(), Target.begin())) &&
-	  (boost::filesystem::exists(Target)) )
+	//Send the most preferred precompressed sibling, which the client accepts. Without an Accept-Encoding header, the
+	//file itself is sent.
+	detail::FSMetaCache::EntryPtr EncodedMeta;
+	const char *ContentEncoding=nullptr;
+	if (AcceptEncodingH)
 	{
-		time_t IfModSinceTime=0;
-		try
+		for (unsigned int PCI=0; PCI!=detail::FSMetaCache::PrecompressedCount; PCI++)
 		{
-			for (const Header &CurrH : HeaderA)
+			if ((Meta->PrecompressedA[PCI]) && (AcceptEncodingH->IsEncodingAccepted(PrecompressedA[PCI].Coding)))
 			{
-				if (CurrH.IntName==HN_IF_MOD_SINCE)
-				{
-					IfModSinceTime=CurrH.GetDateTime();
-					break;
-				}
+				EncodedMeta=Meta->PrecompressedA[PCI];
+				ContentEncoding=PrecompressedA[PCI].Coding;
+				break;
 			}
 		}
-		catch (...) { }
+	}
+
+	detail::ContentCache::ContentPtr Content;
+	if ((!IfModSinceTime) || (Meta->LastModTime>IfModSinceTime))
+		Content=GetContent(EncodedMeta ? EncodedMeta : Meta);
+
+	return new Response(*Meta,IfModSinceTime,&HeaderA,Content,EncodedMeta.get(),ContentEncoding);
+}
 
-		if (!boost::filesystem::is_directory(Target))
-			return new Response(Target,GetMimeType(Target),IfModSinceTime);
+detail::ContentCache::Stats FS::GetContentCacheStats() const
+{
+	if (MyContentCache)
+		return MyContentCache->GetStats();
+	else
+		return detail::ContentCache::Stats{ 0, 0, 0, 0, 0 };
+}
+
+detail::FSMetaCache::EntryPtr FS::LoadMeta(const std::string &Resource)
+{
+	std::shared_ptr<detail::FSMetaCache::Entry> NewEntry=std::make_shared<detail::FSMetaCache::Entry>();
+	unsigned long long LoadGeneration;
+	try
+	{
+		if (std::is_same<boost::filesystem::path::value_type,wchar_t>())
+			NewEntry->Path=boost::filesystem::canonical(Root / boost::locale::conv::utf_to_utf<wchar_t,char>(Resource));
 		else
-			return new CommonError::Response(Resource,HeaderA,NULL,RC_FORBIDDEN);
+			NewEntry->Path=boost::filesystem::canonical(Root / Resource);
+
+		const boost::filesystem::path &Target=NewEntry->Path;
+		if (!IsUnderRoot(Target))
+			return nullptr;
+
+		//Watch the file's directory first, so changes made while it's read are noticed.
+		LoadGeneration=MyMetaCache->Watch(Target);
+
+		boost::filesystem::file_status Status=boost::filesystem::status(Target);
+		if (!boost::filesystem::exists(Status))
+			return nullptr;
+
+		NewEntry->PathStr=Target.string();
+		NewEntry->IsDirectory=boost::filesystem::is_directory(Status);
+		NewEntry->Size=!NewEntry->IsDirectory ? boost::filesystem::file_size(Target) : 0;
+		NewEntry->LastModTime=boost::filesystem::last_write_time(Target);
+		Header::FormatDateTime(NewEntry->LastModTime,NewEntry->LastModifiedStr);
+		NewEntry->MimeType=GetMimeType(Target);
+		NewEntry->LoadTime=std::chrono::steady_clock::now();
 	}
-	else
-		return new CommonError::Response(Resource,HeaderA,NULL,RC_NOTFOUND);
+	catch (...)
+	{ return nullptr; }
+
+	if ((BuildConfig::FSServePrecompressed) && (!NewEntry->IsDirectory))
+	{
+		for (unsigned int PCI=0; PCI!=detail::FSMetaCache::PrecompressedCount; PCI++)
+			NewEntry->PrecompressedA[PCI]=LoadPrecompressedMeta(*NewEntry,PrecompressedA[PCI].Extension);
+	}
+
+	MyMetaCache->Put(Resource,NewEntry,LoadGeneration);
+	return NewEntry;
+}
+
+detail::FSMetaCache::EntryPtr FS::LoadPrecompressedMeta(const detail::FSMetaCache::Entry &Base, const char *Extension) const
+{
+	std::shared_ptr<detail::FSMetaCache::Entry> NewEntry=std::make_shared<detail::FSMetaCache::Entry>();
+	try
+	{
+		boost::filesystem::path SiblingPath=Base.Path;
+		SiblingPath+=Extension;
+
+		boost::system::error_code StatusErr;
+		if (!boost::filesystem::is_regular_file(boost::filesystem::status(SiblingPath,StatusErr)))
+			return nullptr;
+
+		NewEntry->Path=boost::filesystem::canonical(SiblingPath);
+		if (!IsUnderRoot(NewEntry->Path))
+			return nullptr;
+
+		NewEntry->LastModTime=boost::filesystem::last_write_time(NewEntry->Path);
+		if (NewEntry->LastModTime<Base.LastModTime)
+			//Probably left behind by an earlier version of the file.
+			return nullptr;
+
+		NewEntry->PathStr=NewEntry->Path.string();
+		NewEntry->IsDirectory=false;
+		NewEntry->Size=boost::filesystem::file_size(NewEntry->Path);
+		Header::FormatDateTime(NewEntry->LastModTime,NewEntry->LastModifiedStr);
+		NewEntry->MimeType=Base.MimeType;
+		NewEntry->LoadTime=Base.LoadTime;
+	}
+	catch (...)
+	{ return nullptr; }
+
+	return NewEntry;
+}
+
+bool FS::IsUnderRoot(const boost::filesystem::path &Target) const
+{
+	return (std::distance(Root.begin(), Root.end())<=std::distance(Target.begin(), Target.end())) &&
+		(std::equal(Root.begin(), Root.end(), Target.begin()));
+}
+
+detail::ContentCache::ContentPtr FS::GetContent(const detail::FSMetaCache::EntryPtr &Meta)
+{
+	if ((!MyContentCache) || (Meta->Size>BuildConfig::FSContentCacheMaxFileSize))
+		return nullptr;
+
+	detail::ContentCache::ContentPtr Content=MyContentCache->Get(Meta->PathStr,Meta);
+	if (!Content)
+	{
+		Content=LoadContent(*Meta);
+		if (Content)
+			MyContentCache->Put(Meta->PathStr,Meta,Content);
+	}
+
+	return Content;
+}
+
+detail::ContentCache::ContentPtr FS::LoadContent(const detail::FSMetaCache::Entry &Meta)
+{
+	std::shared_ptr<std::vector<unsigned char>> NewContent=std::make_shared<std::vector<unsigned char>>((std::size_t)Meta.Size);
+
+	std::ifstream InS(Meta.PathStr.data(),std::ios_base::binary);
+	if (!InS.is_open())
+		return nullptr;
+
+	//Read one more byte than expected, to detect if the file has grown since it's metadata was loaded.
+	char ExtraByte;
+	InS.read((char *)NewContent->data(),NewContent->size());
+	if ((InS.gcount()!=(std::streamsize)NewContent->size()) || (InS.read(&ExtraByte,1).gcount()!=0))
+		return nullptr;
+
+	return NewContent;
 }
 
 const char *FS::GetMimeType(const boost::filesystem::path &FileName)
@@ -4,6 +4,10 @@
 
 #include <boost/filesystem.hpp>
 
+#include "detail/ByteRanges.h"
+#include "detail/ContentCache.h"
+#include "detail/FSMetaCache.h"
+
 namespace HTTP
 {
 
@@ -13,47 +17,105 @@ namespace RespSource
 class FS : public IRespSource
 {
 public:
-	FS(const boost::filesystem::path &NewRoot);
+	/**@param ContentCacheSize The maximum total length of the file contents cached in memory. Only files up to
+		BuildConfig::FSContentCacheMaxFileSize bytes are cached. Zero disables the content cache.*/
+	FS(const boost::filesystem::path &NewRoot, unsigned long long ContentCacheSize=0);
 	virtual ~FS() { }
 
 	class Response : public IResponse
 	{
 	public:
-		Response(const boost::filesystem::path &FileName, const char *MimeType, time_t IfModifiedSince=0);
-		virtual ~Response() { }
-
-		virtual unsigned int GetExtraHeaderCount() { return 1; }
+		/**@param RequestHeaderA The headers of the request. If specified, byte range requests are supported.*/
+		Response(const boost::filesystem::path &FileName, const char *MimeType, time_t IfModifiedSince=0,
+			const std::vector<Header> *RequestHeaderA=nullptr);
+		/**Creates a response from the cached metadata of a file. Only the file is opened.
+		@param Content The contents of the file. If specified, the file isn't opened.
+		@param EncodedMeta A precompressed sibling of the file, which is sent instead of the file, with the
+			ContentEncoding content coding. If specified, Content is the contents of this file.*/
+		Response(const detail::FSMetaCache::Entry &Meta, time_t IfModifiedSince=0,
+			const std::vector<Header> *RequestHeaderA=nullptr, const detail::ContentCache::ContentPtr &Content=nullptr,
+			const detail::FSMetaCache::Entry *EncodedMeta=nullptr, const char *ContentEncoding=nullptr);
+		virtual ~Response();
+
+		virtual unsigned int GetExtraHeaderCount()
+		{ return 1 + (ContentEncoding ? 1 : 0) + (SendVary ? 1 : 0) + Ranges.GetExtraHeaderCount(); }
 		virtual bool GetExtraHeader(unsigned int Index,
 			const char **OutHeader, const char **OutHeaderEnd,
 			const char **OutHeaderVal, const char **OutHeaderValEnd);
-		virtual unsigned int GetResponseCode() { return FileSize != NotModifiedSize ? RC_OK : RC_NOTMODIFIED; }
-		virtual const char *GetContentType() const { return MyMimeType; }
+		virtual unsigned int GetResponseCode() { return FileSize != NotModifiedSize ? Ranges.GetResponseCode() : (unsigned int)RC_NOTMODIFIED; }
+		virtual const char *GetContentType() const;
 		virtual const char *GetContentTypeCharset() const { return NULL; }
 
-		virtual unsigned long long GetLength() { return FileSize!=NotModifiedSize ? FileSize : 0; }
+		virtual unsigned long long GetLength() { return FileSize!=NotModifiedSize ? Ranges.GetLength() : 0; }
 		virtual bool Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength,
 			boost::asio::yield_context &Ctx);
+		virtual bool GetContentFile(UD::FileUtils::FileHandle &OutFile, unsigned long long &OutOffset);
+		virtual unsigned int GetContentBuffers(boost::asio::const_buffer *OutBuffA, std::shared_ptr<const void> &OutOwner);
 
 	protected:
-		void CloseStream() { InS.close(); }
+		void CloseStream();
 
 	private:
 		static const unsigned long long NotModifiedSize=~(unsigned long long)0;
 
 		unsigned long long FileSize, FilePos;
+		detail::ByteRanges Ranges;
+		detail::ContentCache::ContentPtr Content; //If set, the response is read from here, instead of the file.
 
+#ifdef UD_SENDFILE_SUPPORTED
+		UD::FileUtils::FileHandle InFile;
+#else
 		std::ifstream InS;
+#endif
 
 		const char *MyMimeType;
 		char LastModifiedStr[Header::DateStringLength + 1];
+		const char *ContentEncoding; //Only set for precompressed siblings.
+		bool SendVary; //True, if the response depends on Accept-Encoding.
+
+		static const char *VaryValue;
+
+		void Init(const char *FileName, unsigned long long NewFileSize, time_t LastModTime, time_t IfModifiedSince,
+			const std::vector<Header> *RequestHeaderA);
+
+		/**Reads from the given position of the file.
+		@return The number of bytes read. Zero on error.*/
+		unsigned int ReadAt(unsigned long long Pos, unsigned char *TargetBuff, unsigned int Length);
 	};
 
 	virtual IResponse *Create(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
 		unsigned char *ContentBuff, unsigned char *ContentBuffEnd,
 		AsyncHelperHolder AsyncHelpers, void *ParentConn) override;
 
+	/**@return The statistics of the content cache, or all zeros, if it's disabled.*/
+	detail::ContentCache::Stats GetContentCacheStats() const;
+
 private:
+	struct PrecompressedType
+	{
+		const char *Extension; //Appended to the file name.
+		const char *Coding; //Content-Encoding value.
+	};
+
+	/**The types of the precompressed siblings, in the order of preference.*/
+	static const PrecompressedType PrecompressedA[detail::FSMetaCache::PrecompressedCount];
+
 	boost::filesystem::path Root;
+	std::unique_ptr<detail::FSMetaCache> MyMetaCache;
+	std::unique_ptr<detail::ContentCache> MyContentCache;
+
+	/**Resolves a resource to a file under Root, and stores its metadata in MyMetaCache.
+	@return The metadata of the resource, or nullptr, if it doesn't exist, or it's outside Root.*/
+	detail::FSMetaCache::EntryPtr LoadMeta(const std::string &Resource);
+	/**@return The metadata of a precompressed sibling of a file, or nullptr, if it doesn't exist, it's outside Root, or
+		it's older than the file.*/
+	detail::FSMetaCache::EntryPtr LoadPrecompressedMeta(const detail::FSMetaCache::Entry &Base, const char *Extension) const;
+	bool IsUnderRoot(const boost::filesystem::path &Target) const;
+	/**@return The contents of the file from the content cache (loading it, if needed), or nullptr, if it's not cached.*/
+	detail::ContentCache::ContentPtr GetContent(const detail::FSMetaCache::EntryPtr &Meta);
+	/**Reads the whole file into memory.
+	@return The contents of the file, or nullptr, if it can't be read, or it's length doesn't match the metadata.*/
+	static detail::ContentCache::ContentPtr LoadContent(const detail::FSMetaCache::Entry &Meta);
 
 	static const char *GetMimeType(const boost::filesystem::path &FileName);
 };
@@ -0,0 +1,214 @@
+#include "GzipRespSource.h"
+
+#include <string.h>
+
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "../Common/StringUtils.h"
+
+using namespace HTTP;
+using namespace HTTP::RespSource;
+
+const char *Gzip::Response::GZipEncoding="gzip";
+const char *Gzip::Response::VaryValue="Accept-Encoding";
+
+struct Gzip::Response::DeflateState
+{
+	z_stream ZS;
+
+	DeflateState(int Level)
+	{
+		memset(&ZS,0,sizeof(ZS));
+		//15 + 16: the largest window, with a gzip header and footer.
+		if (deflateInit2(&ZS,Level,Z_DEFLATED,15 + 16,8,Z_DEFAULT_STRATEGY)!=Z_OK)
+			throw std::runtime_error("Cannot initialize compression");
+	}
+	~DeflateState() { deflateEnd(&ZS); }
+};
+
+Gzip::Response::Response(IResponse *NewSource, int Level) : Source(NewSource),
+	IsSourceFinished(false), IsFlushPending(false), IsFinished(false)
+{
+	SourceHeaderCount=Source->GetExtraHeaderCount();
+	//Sources which can send encoded content themselves (like FS) send their own Vary header.
+	IsVaryNeeded=!HasHeader(*Source,HN_VARY);
+
+	if (Level!=NoCompression)
+	{
+		Deflater.reset(new DeflateState(Level));
+		InBuff.resize(BuildConfig::WriteBuffSize);
+	}
+}
+
+Gzip::Response::~Response()
+{
+}
+
+unsigned int Gzip::Response::GetExtraHeaderCount()
+{
+	return SourceHeaderCount + (IsVaryNeeded ? 1 : 0) + (Deflater ? 1 : 0);
+}
+
+bool Gzip::Response::GetExtraHeader(unsigned int Index,
+	const char **OutHeader, const char **OutHeaderEnd,
+	const char **OutHeaderVal, const char **OutHeaderValEnd)
+{
+	if (Index<SourceHeaderCount)
+		return Source->GetExtraHeader(Index,OutHeader,OutHeaderEnd,OutHeaderVal,OutHeaderValEnd);
+
+	Index-=SourceHeaderCount;
+	if (!IsVaryNeeded)
+		Index++;
+
+	if (Index==0)
+	{
+		//Also sent for the uncompressed responses, as the response depends on Accept-Encoding.
+		const std::string &HName=Header::GetHeaderName(HN_VARY);
+		*OutHeader=HName.data();
+		*OutHeaderEnd=HName.data() + HName.size();
+		*OutHeaderVal=VaryValue;
+		*OutHeaderValEnd=VaryValue + strlen(VaryValue);
+
+		return true;
+	}
+	else if ((Index==1) && (Deflater))
+	{
+		const std::string &HName=Header::GetHeaderName(HN_CONTENT_ENCODING);
+		*OutHeader=HName.data();
+		*OutHeaderEnd=HName.data() + HName.size();
+		*OutHeaderVal=GZipEncoding;
+		*OutHeaderValEnd=GZipEncoding + strlen(GZipEncoding);
+
+		return true;
+	}
+	else
+		return false;
+}
+
+unsigned long long Gzip::Response::GetLength()
+{
+	//The compressed length is only known at the end: the response is sent with chunked encoding.
+	return Deflater ? ~(unsigned long long)0 : Source->GetLength();
+}
+
+bool Gzip::Response::Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength,
+	boost::asio::yield_context &Ctx)
+{
+	if (!Deflater)
+		return Source->Read(TargetBuff,MaxLength,OutLength,Ctx);
+
+	z_stream &ZS=Deflater->ZS;
+	ZS.next_out=TargetBuff;
+	ZS.avail_out=MaxLength;
+	while ((ZS.avail_out) && (!IsFinished))
+	{
+		//A new chunk is only read from the source, once the previous one is compressed and flushed.
+		if ((!ZS.avail_in) && (!IsSourceFinished) && (!IsFlushPending))
+		{
+			unsigned int ReadLength;
+			IsSourceFinished=Source->Read(InBuff.data(),(unsigned int)InBuff.size(),ReadLength,Ctx);
+			if (!ReadLength)
+				//Like for uncompressed chunked responses, an empty read finishes the response.
+				IsSourceFinished=true;
+
+			ZS.next_in=InBuff.data();
+			ZS.avail_in=ReadLength;
+		}
+
+		int Result=deflate(&ZS,IsSourceFinished ? Z_FINISH : Z_SYNC_FLUSH);
+		if (Result==Z_STREAM_END)
+			IsFinished=true;
+		else if ((Result!=Z_OK) && (Result!=Z_BUF_ERROR))
+			throw std::runtime_error("Compression error");
+
+		//The flush is complete, if deflate() didn't fill the whole output buffer.
+		IsFlushPending=(!ZS.avail_out) || (ZS.avail_in);
+		if ((!IsFlushPending) && (!IsSourceFinished) && (ZS.avail_out!=MaxLength))
+			//Send the compressed data of this chunk, instead of waiting for the next chunk of the source.
+			break;
+	}
+
+	OutLength=MaxLength-ZS.avail_out;
+	return IsFinished;
+}
+
+bool Gzip::Response::GetContentFile(UD::FileUtils::FileHandle &OutFile, unsigned long long &OutOffset)
+{
+	return Deflater ? false : Source->GetContentFile(OutFile,OutOffset);
+}
+
+unsigned int Gzip::Response::GetContentBuffers(boost::asio::const_buffer *OutBuffA, std::shared_ptr<const void> &OutOwner)
+{
+	return Deflater ? 0 : Source->GetContentBuffers(OutBuffA,OutOwner);
+}
+
+Gzip::Gzip(IRespSource *NewSource, int Level) : Source(NewSource), Level(Level)
+{
+}
+
+IResponse *Gzip::Create(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
+	unsigned char *ContentBuff, unsigned char *ContentBuffEnd,
+	AsyncHelperHolder AsyncHelpers, void *ParentConn)
+{
+	IResponse *Resp=Source->Create(Method,Resource,Query,HeaderA,ContentBuff,ContentBuffEnd,AsyncHelpers,ParentConn);
+	if ((!Resp) || (Resp->GetResponseCode()!=RC_OK) || (!IsCompressible(Resp->GetContentType())) ||
+		(HasHeader(*Resp,HN_CONTENT_ENCODING)))
+		return Resp;
+
+	unsigned long long Length=Resp->GetLength();
+	if ((Length!=~(unsigned long long)0) && (Length<BuildConfig::GzipMinLength))
+		//Never compressed, regardless of Accept-Encoding.
+		return Resp;
+
+	bool IsGzipAccepted=false; //Without an Accept-Encoding header, the response isn't compressed.
+	for (const Header &CurrH : HeaderA)
+	{
+		if (CurrH.IntName==HN_ACCEPT_ENCODING)
+		{
+			IsGzipAccepted=CurrH.IsEncodingAccepted("gzip");
+			break;
+		}
+	}
+
+	return new Response(Resp,IsGzipAccepted ? Level : Response::NoCompression);
+}
+
+bool Gzip::IsCompressible(const char *ContentType)
+{
+	if (!ContentType)
+		return false;
+
+	std::size_t TypeLength=strlen(ContentType);
+	auto StartsWith=[ContentType, TypeLength](const char *Prefix)
+	{
+		std::size_t PrefixLength=strlen(Prefix);
+		return (TypeLength>=PrefixLength) && (!UD::StringUtils::CmpI(Prefix,ContentType,ContentType + PrefixLength));
+	};
+	auto EndsWith=[ContentType, TypeLength](const char *Suffix)
+	{
+		std::size_t SuffixLength=strlen(Suffix);
+		return (TypeLength>=SuffixLength) &&
+			(!UD::StringUtils::CmpI(Suffix,ContentType + TypeLength-SuffixLength,ContentType + TypeLength));
+	};
+
+	return (StartsWith("text/")) || (EndsWith("+json")) || (EndsWith("+xml")) ||
+		(!UD::StringUtils::CmpI("application/json",ContentType)) ||
+		(!UD::StringUtils::CmpI("application/javascript",ContentType)) ||
+		(!UD::StringUtils::CmpI("application/xml",ContentType));
+}
+
+bool Gzip::HasHeader(IResponse &Resp, HEADERNAME Name)
+{
+	const std::string &HName=Header::GetHeaderName(Name);
+	for (unsigned int HeaderI=0, HeaderCount=Resp.GetExtraHeaderCount(); HeaderI!=HeaderCount; ++HeaderI)
+	{
+		const char *CurrName, *CurrNameEnd, *CurrValue, *CurrValueEnd;
+		if ((Resp.GetExtraHeader(HeaderI,&CurrName,&CurrNameEnd,&CurrValue,&CurrValueEnd)) &&
+			(!UD::StringUtils::CmpI(HName.data(),CurrName,CurrNameEnd)))
+			return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "../IRespSource.h"
+#include "../BuildConfig.h"
+
+namespace HTTP
+{
+
+namespace RespSource
+{
+
+/**Compresses the responses of another response source on the fly, with gzip content-encoding. Only successful
+responses with a compressible content type (text, JSON, XML, JavaScript, SVG) are compressed, which aren't encoded
+already, and are at least BuildConfig::GzipMinLength bytes long (or their length is unknown). The compressed responses
+are sent with chunked encoding.
+Wrap the sources of the routes which should be compressed (for example, in a Combiner), with the compression level
+appropriate for the route.*/
+class Gzip : public IRespSource
+{
+public:
+	/**@param NewSource The wrapped response source. It's owned by this object.
+	@param Level The zlib compression level: 1 (fastest) to 9 (best compression).*/
+	Gzip(IRespSource *NewSource, int Level=BuildConfig::GzipDefaultLevel);
+	virtual ~Gzip() { }
+
+	class Response : public IResponse
+	{
+	public:
+		/**@param NewSource The response to compress. It's owned by this object.
+		@param Level The zlib compression level, or NoCompression, to only add a Vary header to the response.*/
+		Response(IResponse *NewSource, int Level);
+		virtual ~Response();
+
+		static const int NoCompression = -2;
+
+		virtual unsigned int GetExtraHeaderCount();
+		virtual bool GetExtraHeader(unsigned int Index,
+			const char **OutHeader, const char **OutHeaderEnd,
+			const char **OutHeaderVal, const char **OutHeaderValEnd);
+		virtual unsigned int GetResponseCode() { return Source->GetResponseCode(); }
+		virtual const char *GetContentType() const { return Source->GetContentType(); }
+		virtual const char *GetContentTypeCharset() const { return Source->GetContentTypeCharset(); }
+
+		virtual unsigned long long GetLength();
+		virtual bool Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength,
+			boost::asio::yield_context &Ctx);
+		virtual bool GetContentFile(UD::FileUtils::FileHandle &OutFile, unsigned long long &OutOffset);
+		virtual unsigned int GetContentBuffers(boost::asio::const_buffer *OutBuffA, std::shared_ptr<const void> &OutOwner);
+		virtual bool OnBodyData(const unsigned char *Begin, const unsigned char *End, boost::asio::yield_context &Ctx)
+		{ return Source->OnBodyData(Begin,End,Ctx); }
+		virtual ConnectionBase *Upgrade(ConnectionBase *CurrConn) { return Source->Upgrade(CurrConn); }
+
+	private:
+		struct DeflateState;
+
+		std::unique_ptr<IResponse> Source;
+		std::unique_ptr<DeflateState> Deflater; //Only set, if compressing.
+		std::vector<unsigned char> InBuff; //The last chunk read from Source.
+		unsigned int SourceHeaderCount;
+		bool IsVaryNeeded; //False, if Source already sends a Vary header.
+		bool IsSourceFinished, IsFlushPending, IsFinished;
+
+		static const char *GZipEncoding, *VaryValue;
+	};
+
+	virtual void SetServerLog(IServerLog *NewLog) override { Source->SetServerLog(NewLog); }
+	virtual bool IsBodyStreamed(METHOD Method, const std::string &Resource, const std::vector<Header> &HeaderA) override
+	{ return Source->IsBodyStreamed(Method,Resource,HeaderA); }
+	virtual IResponse *OnExpectContinue(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
+		AsyncHelperHolder AsyncHelpers, void *ParentConn) override
+	{ return Source->OnExpectContinue(Method,Resource,Query,HeaderA,AsyncHelpers,ParentConn); }
+
+	virtual IResponse *Create(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
+		unsigned char *ContentBuff, unsigned char *ContentBuffEnd,
+		AsyncHelperHolder AsyncHelpers, void *ParentConn) override;
+
+	/**@return True, if responses of the given content type should be compressed.*/
+	static bool IsCompressible(const char *ContentType);
+
+private:
+	std::unique_ptr<IRespSource> Source;
+	int Level;
+
+	/**@return True, if the response has a header with the given name.*/
+	static bool HasHeader(IResponse &Resp, HEADERNAME Name);
+};
+
+}; //RespSource
+
+}; //HTTP
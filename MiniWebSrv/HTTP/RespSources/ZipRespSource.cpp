@@ -10,6 +10,7 @@ using namespace HTTP::RespSource;
 
 const char *Zip::Response::IdentityEncoding="identity";
 const char *Zip::Response::GZipEncoding="gzip";
+const char *Zip::Response::VaryValue="Accept-Encoding";
 unsigned char Zip::Response::GZipHeaderA[10]={
 	31, 139, //ID1 ID2
 	8, //CM; 8: deflate
@@ -19,30 +20,35 @@ unsigned char Zip::Response::GZipHeaderA[10]={
 	255 //OS
 };
 
-Zip::Response::Response(ZipArchive::Stream *ArchS, const char *MimeType, time_t IfModifiedSince) : MyMimeType(MimeType)
+Zip::Response::Response(ZipArchive::Stream *ArchS, const char *MimeType, time_t IfModifiedSince,
+	const std::vector<Header> *RequestHeaderA, const std::shared_ptr<const void> &ArchiveOwner,
+	const detail::ContentCache::ContentPtr &Content) :
+	MyArchiveOwner(ArchiveOwner), Content(Content), MyMimeType(MimeType)
 {
 	time_t LastModTime=ArchS->GetInfo()->LastModTime;
 	Header::FormatDateTime(LastModTime,LastModifiedStr);
 
+	IsCompressed=ArchS->GetInfo()->Compression==ZipArchive::CM_DEFLATE;
 	if (LastModTime>IfModifiedSince)
 	{
 		SourceS=ArchS;
-		FileSize=ArchS->GetInfo()->CompressedSize;
 
-		if (SourceS->GetInfo()->Compression==ZipArchive::CM_DEFLATE)
+		if ((IsCompressed) && (!Content) && (!ArchS->IsDecompressing()))
 		{
-			//Compose a Gzip footer.
-			unsigned int *FooterFieldA=(unsigned int *)GzipFooterA;
-			FooterFieldA[0]=SourceS->GetInfo()->CRC32;
-			FooterFieldA[1]=SourceS->GetInfo()->UncompressedSize;
-
 			CState=CS_HEADER;
 			CStatePos=0;
 
-			FileSize+=sizeof(GZipHeaderA) + sizeof(GzipFooterA);
+			FileSize=ArchS->GetInfo()->CompressedSize + sizeof(GZipHeaderA) + sizeof(ArchS->GetInfo()->GzipFooterA);
+			Ranges.Init(nullptr,FileSize,LastModifiedStr,MimeType);
 		}
 		else
+		{
 			CState=CS_BODYONLY;
+			FileSize=Content ? Content->size() : ArchS->GetLength();
+			//Seeking backwards in an inflated stream restarts the decompression, so it only supports ranges, if the
+			//decompressed content is cached.
+			Ranges.Init(((!Content) && (ArchS->IsDecompressing())) ? nullptr : RequestHeaderA,FileSize,LastModifiedStr,MimeType);
+		}
 	}
 	else
 	{
@@ -72,7 +78,7 @@ bool Zip::Response::GetExtraHeader(unsigned int Index,
 		*OutHeader=HName.data();
 		*OutHeaderEnd=HName.data() + HName.size();
 
-		if ((!SourceS) || (SourceS->GetInfo()->Compression!=ZipArchive::CM_DEFLATE))
+		if ((!SourceS) || (CState==CS_BODYONLY))
 		{
 			*OutHeaderVal=IdentityEncoding;
 			*OutHeaderValEnd=IdentityEncoding + strlen(IdentityEncoding);
@@ -85,14 +91,39 @@ bool Zip::Response::GetExtraHeader(unsigned int Index,
 
 		return true;
 	}
+	else if ((Index==2) && (IsCompressed))
+	{
+		const std::string &HName=Header::GetHeaderName(HN_VARY);
+		*OutHeader=HName.data();
+		*OutHeaderEnd=HName.data() + HName.size();
+		*OutHeaderVal=VaryValue;
+		*OutHeaderValEnd=VaryValue + strlen(VaryValue);
+
+		return true;
+	}
+	else if (SourceS)
+		return Ranges.GetExtraHeader(Index-(IsCompressed ? 3 : 2),OutHeader,OutHeaderEnd,OutHeaderVal,OutHeaderValEnd);
 	else
 		return false;
 }
 
+const char *Zip::Response::GetContentType() const
+{
+	if (const char *RangesType=Ranges.GetContentType())
+		return RangesType;
+	else
+		return MyMimeType;
+}
+
 bool Zip::Response::Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength,
 		boost::asio::yield_context &Ctx)
 {
-	if (FileSize!=NotModifiedSize)
+	if ((FileSize!=NotModifiedSize) && (CState==CS_BODYONLY))
+	{
+		return Ranges.Read(TargetBuff,MaxLength,OutLength,
+			[this](unsigned long long Pos, unsigned char *Target, unsigned int Length) { return ReadAt(Pos,Target,Length); });
+	}
+	else if (FileSize!=NotModifiedSize)
 	{
 		unsigned int RemLength=MaxLength;
 		while (RemLength)
@@ -100,21 +131,12 @@ bool Zip::Response::Read(unsigned char *TargetBuff, unsigned int MaxLength, unsi
 			switch (CState)
 			{
 			case CS_BODY:
-			case CS_BODYONLY:
 				{
 					unsigned int ReadCount=SourceS->Read((char *)TargetBuff,RemLength);
 					if (ReadCount<RemLength)
 					{
-						if (CState==CS_BODY)
-						{
-							CState=CS_FOOTER;
-							CStatePos=0;
-						}
-						else
-						{
-							OutLength=MaxLength-RemLength;
-							return true;
-						}
+						CState=CS_FOOTER;
+						CStatePos=0;
 					}
 
 					RemLength-=ReadCount;
@@ -141,11 +163,18 @@ bool Zip::Response::Read(unsigned char *TargetBuff, unsigned int MaxLength, unsi
 					TargetBuff+=CopyLen;
 				}
 				break;
+			case CS_BODYONLY:
+				//Stored files are read through Ranges.
+				OutLength=MaxLength-RemLength;
+				return true;
 			case CS_FOOTER:
 				{
+					const unsigned char *GzipFooterA=SourceS->GetInfo()->GzipFooterA;
+					const unsigned int FooterLength=sizeof(SourceS->GetInfo()->GzipFooterA);
+
 					unsigned int CopyLen;
-					if (RemLength>=sizeof(GzipFooterA)-CStatePos)
-						CopyLen=sizeof(GzipFooterA)-CStatePos;
+					if (RemLength>=FooterLength-CStatePos)
+						CopyLen=FooterLength-CStatePos;
 					else
 						CopyLen=RemLength;
 
@@ -154,7 +183,7 @@ bool Zip::Response::Read(unsigned char *TargetBuff, unsigned int MaxLength, unsi
 					RemLength-=CopyLen;
 					TargetBuff+=CopyLen;
 
-					if (CStatePos==sizeof(GzipFooterA))
+					if (CStatePos==FooterLength)
 					{
 						OutLength=MaxLength-RemLength;
 						return true;
@@ -174,36 +203,174 @@ bool Zip::Response::Read(unsigned char *TargetBuff, unsigned int MaxLength, unsi
 	}
 }
 
-Zip::Zip(const boost::filesystem::path &ArchiveFN) : MyArch(ArchiveFN.string())
+unsigned int Zip::Response::ReadAt(unsigned long long Pos, unsigned char *TargetBuff, unsigned int Length)
 {
+	if (Content)
+	{
+		if (Pos>=Content->size())
+			return 0;
+		else if (Length>Content->size()-Pos)
+			Length=(unsigned int)(Content->size()-Pos);
+
+		memcpy(TargetBuff,Content->data()+Pos,Length);
+		return Length;
+	}
+
+	if (Pos!=SourceS->GetPos())
+		SourceS->Seek(Pos);
+
+	return SourceS->Read((char *)TargetBuff,Length);
+}
+
+unsigned int Zip::Response::GetContentBuffers(boost::asio::const_buffer *OutBuffA, std::shared_ptr<const void> &OutOwner)
+{
+	if (FileSize==NotModifiedSize)
+		return 0;
+
+	const ZipArchive::FileInfo *Info=SourceS->GetInfo();
+	if (CState==CS_BODYONLY)
+	{
+		unsigned long long RangeBegin, RangeLength;
+		if ((SourceS->GetPos()) || (!Ranges.GetSingleRange(RangeBegin,RangeLength)))
+			return 0;
+
+		if (Content)
+		{
+			OutBuffA[0]=boost::asio::const_buffer(Content->data()+RangeBegin,(std::size_t)RangeLength);
+			OutOwner=Content;
+			return 1;
+		}
+		else if ((MyArchiveOwner) && (!SourceS->IsDecompressing()))
+		{
+			OutBuffA[0]=boost::asio::const_buffer(SourceS->GetData()+RangeBegin,(std::size_t)RangeLength);
+			OutOwner=MyArchiveOwner;
+			return 1;
+		}
+		else
+			return 0;
+	}
+	else if (!MyArchiveOwner)
+		return 0;
+	else if ((CState==CS_HEADER) && (!CStatePos))
+	{
+		//The gzip header and footer are sent from separate buffers, around the compressed data.
+		OutBuffA[0]=boost::asio::const_buffer(GZipHeaderA,sizeof(GZipHeaderA));
+		OutBuffA[1]=boost::asio::const_buffer(SourceS->GetData(),(std::size_t)Info->CompressedSize);
+		OutBuffA[2]=boost::asio::const_buffer(Info->GzipFooterA,sizeof(Info->GzipFooterA));
+		OutOwner=MyArchiveOwner;
+		return 3;
+	}
+	else
+		return 0;
+}
+
+Zip::Zip(const boost::filesystem::path &ArchiveFN, unsigned long long InflateCacheSize,
+	const boost::filesystem::path &IndexFN) :
+	MyArch(std::make_shared<ZipArchive>(ArchiveFN.string(),IndexFN.string()))
+{
+	if (InflateCacheSize)
+		MyInflateCache.reset(new detail::ContentCache(InflateCacheSize));
 }
 
 IResponse *Zip::Create(METHOD Method, std::string &Resource, QueryParams &Query, std::vector<Header> &HeaderA,
 		unsigned char *ContentBuff, unsigned char *ContentBuffEnd,
 		AsyncHelperHolder AsyncHelpers, void *ParentConn)
 {
-	const ZipArchive::FileInfo *TargetFI=MyArch.Get(Resource.length() ? Resource.substr(1,Resource.length()-1) : Resource);
+	//The archive may be replaced by Reload() meanwhile: the responses keep this one alive.
+	std::shared_ptr<ZipArchive> CurrArch=std::atomic_load(&MyArch);
+
+	std::string_view EntryName=Resource.length() ? std::string_view(Resource).substr(1) : std::string_view(Resource);
+	const ZipArchive::FileInfo *TargetFI=CurrArch->Get(EntryName);
 	if (!TargetFI)
 		return new CommonError::Response(Resource,HeaderA,NULL,RC_NOTFOUND);
 
 	time_t IfModSinceTime=0;
+	bool IsGzipAccepted=true; //Without an Accept-Encoding header, every content coding is acceptable.
+	for (const Header &CurrH : HeaderA)
+	{
+		if (CurrH.IntName==HN_IF_MOD_SINCE)
+		{
+			try { IfModSinceTime=CurrH.GetDateTime(); }
+			catch (...) { }
+		}
+		else if (CurrH.IntName==HN_ACCEPT_ENCODING)
+			IsGzipAccepted=CurrH.IsEncodingAccepted("gzip");
+	}
+
 	try
 	{
-		for (const Header &CurrH : HeaderA)
+		bool Decompress=(TargetFI->Compression==ZipArchive::CM_DEFLATE) && (!IsGzipAccepted);
+
+		detail::ContentCache::ContentPtr Content;
+		if ((Decompress) && (MyInflateCache) && (TargetFI->UncompressedSize<=BuildConfig::ZipInflateCacheMaxFileSize) &&
+			(TargetFI->LastModTime>IfModSinceTime))
 		{
-			if (CurrH.IntName==HN_IF_MOD_SINCE)
+			std::string CacheKey(EntryName);
+			Content=MyInflateCache->Get(CacheKey,CurrArch);
+			if ((!Content) && (CountInflateRequest(CacheKey)))
 			{
-				IfModSinceTime=CurrH.GetDateTime();
-				break;
+				Content=Inflate(*CurrArch,TargetFI);
+				if (Content)
+					MyInflateCache->Put(CacheKey,CurrArch,Content);
 			}
 		}
-	}
-	catch (...) { }
 
-	try { return new Response(MyArch.GetStream(TargetFI,false),GetMimeType(Resource),IfModSinceTime); }
+		return new Response(CurrArch->GetStream(TargetFI,(Decompress) && (!Content)),GetMimeType(Resource),IfModSinceTime,
+			&HeaderA,CurrArch,Content);
+	}
 	catch (...) { return new CommonError::Response(Resource,HeaderA,NULL,RC_NOTFOUND); }
 }
 
+void Zip::Reload(const boost::filesystem::path &ArchiveFN, const boost::filesystem::path &IndexFN)
+{
+	std::shared_ptr<ZipArchive> NewArch=std::make_shared<ZipArchive>(ArchiveFN.string(),IndexFN.string());
+
+	{
+		//The cached decompressed entries are bound to the old archive, so they will be dropped by the cache.
+		std::lock_guard<std::mutex> lock(InflateCountMtx);
+		InflateCountMap.clear();
+	}
+
+	std::atomic_store(&MyArch,NewArch);
+}
+
+detail::ContentCache::Stats Zip::GetInflateCacheStats() const
+{
+	if (MyInflateCache)
+		return MyInflateCache->GetStats();
+	else
+		return detail::ContentCache::Stats{ 0, 0, 0, 0, 0 };
+}
+
+bool Zip::CountInflateRequest(const std::string &EntryName)
+{
+	std::lock_guard<std::mutex> lock(InflateCountMtx);
+	return ++InflateCountMap[EntryName]>=BuildConfig::ZipInflateCacheMinRequestCount;
+}
+
+detail::ContentCache::ContentPtr Zip::Inflate(ZipArchive &Arch, const ZipArchive::FileInfo *Info)
+{
+	std::unique_ptr<ZipArchive::Stream> InflateS(Arch.GetStream(Info,true));
+	std::shared_ptr<std::vector<unsigned char>> NewContent=std::make_shared<std::vector<unsigned char>>((std::size_t)Info->UncompressedSize);
+
+	//Read one more byte than expected, to detect corrupt entries.
+	std::size_t ContentLength=0;
+	char ExtraByte;
+	while (ContentLength!=NewContent->size())
+	{
+		unsigned int ReadLength=InflateS->Read((char *)NewContent->data()+ContentLength,(unsigned int)(NewContent->size()-ContentLength));
+		if (!ReadLength)
+			return nullptr;
+
+		ContentLength+=ReadLength;
+	}
+
+	if (InflateS->Read(&ExtraByte,1))
+		return nullptr;
+
+	return NewContent;
+}
+
 const char *Zip::GetMimeType(const std::string &FileName)
 {
 	std::string::size_type DotPos=FileName.rfind('.');
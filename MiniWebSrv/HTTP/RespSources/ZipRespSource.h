@@ -2,9 +2,15 @@
 
 #include "../IRespSource.h"
 
+#include <mutex>
+#include <unordered_map>
+
 #include <boost/filesystem.hpp>
 
+#include "../BuildConfig.h"
 #include "detail/ZipArchive.h"
+#include "detail/ByteRanges.h"
+#include "detail/ContentCache.h"
 
 namespace HTTP
 {
@@ -15,26 +21,45 @@ namespace RespSource
 class Zip : public IRespSource
 {
 public:
-	Zip(const boost::filesystem::path &ArchiveFN);
+	/**@param InflateCacheSize The maximum total length of the decompressed entries, cached for clients without gzip
+		support. Zero disables the cache.
+	@param IndexFN The sidecar index file of the archive (see ZipArchive). If it's valid, it's memory mapped instead of
+		parsing the central directory of the archive. Otherwise, it's rebuilt. If empty, no index file is used.*/
+	Zip(const boost::filesystem::path &ArchiveFN, unsigned long long InflateCacheSize=BuildConfig::ZipInflateCacheSize,
+		const boost::filesystem::path &IndexFN=boost::filesystem::path());
 	virtual ~Zip() { }
 
 	class Response : public IResponse
 	{
 	public:
-		Response(ZipArchive::Stream *ArchS, const char *MimeType, time_t IfModifiedSince=0);
+		/**@param ArchS The stream of the file. Compressed files are sent as a gzip stream, unless ArchS decompresses them.
+		@param RequestHeaderA The headers of the request. If specified, byte range requests are supported for files,
+			which aren't sent as a gzip stream.
+		@param ArchiveOwner Keeps the archive of ArchS alive. If specified, the response is queued for writing directly
+			from the mapped archive.
+		@param Content The decompressed contents of the file. If specified, it's sent instead of the data of ArchS.*/
+		Response(ZipArchive::Stream *ArchS, const char *MimeType, time_t IfModifiedSince=0,
+			const std::vector<Header> *RequestHeaderA=nullptr, const std::shared_ptr<const void> &ArchiveOwner=nullptr,
+			const detail::ContentCache::ContentPtr &Content=nullptr);
 		virtual ~Response() { delete SourceS; }
 
-		virtual unsigned int GetExtraHeaderCount() { return 2; }
+		virtual unsigned int GetExtraHeaderCount() { return (IsCompressed ? 3 : 2) + Ranges.GetExtraHeaderCount(); }
 		virtual bool GetExtraHeader(unsigned int Index,
 			const char **OutHeader, const char **OutHeaderEnd,
 			const char **OutHeaderVal, const char **OutHeaderValEnd);
-		virtual unsigned int GetResponseCode() { return FileSize != NotModifiedSize ? RC_OK : RC_NOTMODIFIED; }
-		virtual const char *GetContentType() const { return MyMimeType; }
+		virtual unsigned int GetResponseCode() { return FileSize != NotModifiedSize ? Ranges.GetResponseCode() : (unsigned int)RC_NOTMODIFIED; }
+		virtual const char *GetContentType() const;
 		virtual const char *GetContentTypeCharset() const { return NULL; }
 
-		virtual unsigned long long GetLength() { return FileSize!=NotModifiedSize ? FileSize : 0; }
+		virtual unsigned long long GetLength() { return FileSize!=NotModifiedSize ? Ranges.GetLength() : 0; }
 		virtual bool Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength,
 			boost::asio::yield_context &Ctx);
+		virtual unsigned int GetContentBuffers(boost::asio::const_buffer *OutBuffA, std::shared_ptr<const void> &OutOwner);
+
+	protected:
+		/**Reads from the given position of the (not gzip) response body.
+		@return The number of bytes read.*/
+		unsigned int ReadAt(unsigned long long Pos, unsigned char *TargetBuff, unsigned int Length);
 
 	private:
 		static const unsigned long long NotModifiedSize=~(unsigned long long)0;
@@ -49,13 +74,16 @@ public:
 
 		unsigned long long FileSize;
 		ZipArchive::Stream *SourceS;
-		unsigned char GzipFooterA[8];
+		std::shared_ptr<const void> MyArchiveOwner;
+		detail::ContentCache::ContentPtr Content;
+		detail::ByteRanges Ranges; //Not used for gzip streams.
+		bool IsCompressed; //True, if the file is compressed in the archive: the response depends on Accept-Encoding.
 		CONTENTSTATE CState;
 		unsigned int CStatePos;
 
 		const char *MyMimeType;
 		char LastModifiedStr[Header::DateStringLength + 1];
-		static const char *IdentityEncoding, *GZipEncoding;
+		static const char *IdentityEncoding, *GZipEncoding, *VaryValue;
 		static unsigned char GZipHeaderA[10];
 	};
 
@@ -63,8 +91,29 @@ public:
 		unsigned char *ContentBuff, unsigned char *ContentBuffEnd,
 		AsyncHelperHolder AsyncHelpers, void *ParentConn) override;
 
+	/**Opens another archive, and replaces the served one with it atomically. The archive is loaded on the calling
+	thread, so this can be called from any thread while requests are served. The old archive is closed once the last
+	response reading from it is finished.
+	@param IndexFN The sidecar index file of the new archive, or empty.
+	@throws ZipArchive::Exception If the new archive cannot be opened. The current archive is kept.*/
+	void Reload(const boost::filesystem::path &ArchiveFN, const boost::filesystem::path &IndexFN=boost::filesystem::path());
+
+	/**@return The statistics of the decompressed entry cache, or all zeros, if it's disabled.*/
+	detail::ContentCache::Stats GetInflateCacheStats() const;
+
 private:
-	ZipArchive MyArch;
+	std::shared_ptr<ZipArchive> MyArch; //Only accessed with std::atomic_load and std::atomic_store.
+	std::unique_ptr<detail::ContentCache> MyInflateCache;
+
+	std::mutex InflateCountMtx;
+	std::unordered_map<std::string,unsigned int> InflateCountMap; //Entry name -> number of requests without gzip support.
+
+	/**Counts a request for the decompressed entry.
+	@return True, if the entry was requested often enough to cache it decompressed.*/
+	bool CountInflateRequest(const std::string &EntryName);
+	/**Decompresses the whole entry into memory.
+	@return The decompressed entry, or nullptr on error.*/
+	detail::ContentCache::ContentPtr Inflate(ZipArchive &Arch, const ZipArchive::FileInfo *Info);
 
 	static const char *GetMimeType(const std::string &FileName);
 };
@@ -0,0 +1,274 @@
+#include "ByteRanges.h"
+
+#include <atomic>
+#include <chrono>
+
+#include "../../Common.h"
+#include "../../Common/StringUtils.h"
+
+using namespace HTTP;
+using namespace HTTP::detail;
+
+ByteRanges::ByteRanges() : IsSupported(false), State(RS_NONE), TotalLength(0), RespLength(0), ContentType(nullptr),
+	Phase(PH_DONE), RangeI(0), PartPos(0)
+{
+	ContentRangeStr[0]='\0';
+}
+
+void ByteRanges::Init(const std::vector<Header> *HeaderA, unsigned long long NewTotalLength, const char *LastModifiedStr,
+	const char *NewContentType)
+{
+	IsSupported=HeaderA!=nullptr;
+	TotalLength=NewTotalLength;
+	ContentType=NewContentType;
+	ContentRangeStr[0]='\0';
+	Boundary.clear();
+	MultipartContentType.clear();
+	RangeA.clear();
+
+	const char *RangeVal=nullptr, *IfRangeVal=nullptr;
+	if (HeaderA)
+	{
+		for (const Header &CurrH : *HeaderA)
+		{
+			if (CurrH.IntName==HN_RANGE)
+				RangeVal=CurrH.Value;
+			else if (CurrH.IntName==HN_IF_RANGE)
+				IfRangeVal=CurrH.Value;
+		}
+	}
+
+	//Only dates are accepted in If-Range, as no entity tags are sent. The date must match exactly.
+	bool IsRangeValid=(RangeVal) && ((!IfRangeVal) || ((LastModifiedStr) && (strcmp(IfRangeVal,LastModifiedStr)==0)));
+	if ((IsRangeValid) && (!ParseRange(RangeVal)))
+	{
+		//Syntax error: ignore the Range header.
+		RangeA.clear();
+		IsRangeValid=false;
+	}
+
+	PartPos=0;
+	RangeI=0;
+	if (!IsRangeValid)
+	{
+		State=RS_NONE;
+		RangeA.push_back(Range{ 0, TotalLength });
+		RespLength=TotalLength;
+		Phase=TotalLength ? PH_DATA : PH_DONE;
+	}
+	else if (RangeA.empty())
+	{
+		State=RS_UNSATISFIABLE;
+		RespLength=0;
+		Phase=PH_DONE;
+		sprint_safe(ContentRangeStr,sizeof(ContentRangeStr),"bytes */%llu",TotalLength);
+	}
+	else if (RangeA.size()==1)
+	{
+		State=RS_PARTIAL;
+		RespLength=RangeA[0].End-RangeA[0].Begin;
+		Phase=PH_DATA;
+		sprint_safe(ContentRangeStr,sizeof(ContentRangeStr),"bytes %llu-%llu/%llu",RangeA[0].Begin,RangeA[0].End-1,TotalLength);
+	}
+	else
+	{
+		State=RS_PARTIAL;
+
+		//The boundary only has to be unlikely to appear in the content.
+		static std::atomic_uint BoundaryCounter(0);
+		char BoundaryStr[40];
+		sprint_safe(BoundaryStr,sizeof(BoundaryStr),"MWSByteRanges%016llx%08x",
+			(unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count(),BoundaryCounter.fetch_add(1));
+		Boundary=BoundaryStr;
+		MultipartContentType="multipart/byteranges; boundary=";
+		MultipartContentType+=Boundary;
+
+		RespLength=0;
+		for (unsigned int PartI=0; PartI!=(unsigned int)RangeA.size(); ++PartI)
+		{
+			FormatPartHeader(PartI,PartHeaderStr);
+			RespLength+=PartHeaderStr.length() + RangeA[PartI].End-RangeA[PartI].Begin;
+		}
+
+		FormatFinalDelimiter(PartHeaderStr);
+		RespLength+=PartHeaderStr.length();
+
+		FormatPartHeader(0,PartHeaderStr);
+		Phase=PH_PARTHEADER;
+	}
+}
+
+unsigned int ByteRanges::GetResponseCode() const
+{
+	switch (State)
+	{
+	case RS_PARTIAL: return RC_PARTIALCONTENT;
+	case RS_UNSATISFIABLE: return RC_RANGENOTSATISFIABLE;
+	default: return RC_OK;
+	}
+}
+
+const char *ByteRanges::GetContentType() const
+{
+	return !MultipartContentType.empty() ? MultipartContentType.c_str() : nullptr;
+}
+
+bool ByteRanges::GetSingleRange(unsigned long long &OutBegin, unsigned long long &OutLength) const
+{
+	if ((State!=RS_UNSATISFIABLE) && (RangeA.size()==1))
+	{
+		OutBegin=RangeA[0].Begin;
+		OutLength=RangeA[0].End-RangeA[0].Begin;
+		return true;
+	}
+	else
+		return false;
+}
+
+bool ByteRanges::GetExtraHeader(unsigned int Index,
+	const char **OutHeader, const char **OutHeaderEnd,
+	const char **OutHeaderVal, const char **OutHeaderValEnd) const
+{
+	static const char *BytesUnit="bytes";
+
+	if (!IsSupported)
+		return false;
+	else if (Index==0)
+	{
+		const std::string &HName=Header::GetHeaderName(HN_ACCEPT_RANGES);
+		*OutHeader=HName.data();
+		*OutHeaderEnd=HName.data() + HName.size();
+		*OutHeaderVal=BytesUnit;
+		*OutHeaderValEnd=BytesUnit + strlen(BytesUnit);
+
+		return true;
+	}
+	else if ((Index==1) && (ContentRangeStr[0]))
+	{
+		const std::string &HName=Header::GetHeaderName(HN_CONTENT_RANGE);
+		*OutHeader=HName.data();
+		*OutHeaderEnd=HName.data() + HName.size();
+		*OutHeaderVal=ContentRangeStr;
+		*OutHeaderValEnd=ContentRangeStr + strlen(ContentRangeStr);
+
+		return true;
+	}
+	else
+		return false;
+}
+
+bool ByteRanges::ParseRange(const char *Value)
+{
+	//Sample: "bytes=0-499, 1000-, -500"
+	static const char *BytesPrefix="bytes=";
+	if (UD::StringUtils::CmpI(BytesPrefix,Value,Value+strlen(BytesPrefix))!=0)
+		return false;
+
+	const char *CurrPos=Value+strlen(BytesPrefix);
+	unsigned int SpecCount=0;
+	while (true)
+	{
+		while ((UD::StringUtils::IsSpace(*CurrPos)) || (*CurrPos==','))
+			++CurrPos;
+
+		if (!*CurrPos)
+			break;
+
+		if (++SpecCount>MaxRangeCount)
+			return false;
+
+		if (*CurrPos=='-')
+		{
+			//Suffix range: the last N bytes.
+			++CurrPos;
+
+			unsigned long long SuffixLength;
+			if (!ParseNumber(CurrPos,SuffixLength))
+				return false;
+
+			if ((SuffixLength) && (TotalLength))
+				RangeA.push_back(Range{ SuffixLength<TotalLength ? TotalLength-SuffixLength : 0, TotalLength });
+		}
+		else
+		{
+			unsigned long long First, Last=~(unsigned long long)0;
+			if ((!ParseNumber(CurrPos,First)) || (*CurrPos!='-'))
+				return false;
+
+			++CurrPos;
+			if ((*CurrPos>='0') && (*CurrPos<='9'))
+			{
+				if ((!ParseNumber(CurrPos,Last)) || (Last<First))
+					return false;
+			}
+
+			if (First<TotalLength)
+				RangeA.push_back(Range{ First, (Last<TotalLength ? Last : TotalLength-1) + 1 });
+		}
+
+		while (UD::StringUtils::IsSpace(*CurrPos))
+			++CurrPos;
+
+		if ((*CurrPos) && (*CurrPos!=','))
+			return false;
+	}
+
+	return SpecCount!=0;
+}
+
+void ByteRanges::NextPart()
+{
+	++RangeI;
+	PartPos=0;
+
+	if (MultipartContentType.empty())
+		Phase=PH_DONE;
+	else if (RangeI<RangeA.size())
+	{
+		FormatPartHeader(RangeI,PartHeaderStr);
+		Phase=PH_PARTHEADER;
+	}
+	else
+	{
+		FormatFinalDelimiter(PartHeaderStr);
+		Phase=PH_FINAL;
+	}
+}
+
+void ByteRanges::FormatPartHeader(unsigned int Index, std::string &Target) const
+{
+	char RangeStr[80];
+	sprint_safe(RangeStr,sizeof(RangeStr),"\r\nContent-Range: bytes %llu-%llu/%llu\r\n\r\n",
+		RangeA[Index].Begin,RangeA[Index].End-1,TotalLength);
+
+	Target="\r\n--";
+	Target+=Boundary;
+	Target+="\r\nContent-Type: ";
+	Target+=ContentType;
+	Target+=RangeStr;
+}
+
+void ByteRanges::FormatFinalDelimiter(std::string &Target) const
+{
+	Target="\r\n--";
+	Target+=Boundary;
+	Target+="--\r\n";
+}
+
+bool ByteRanges::ParseNumber(const char *&Pos, unsigned long long &OutVal)
+{
+	if ((*Pos<'0') || (*Pos>'9'))
+		return false;
+
+	OutVal=0;
+	while ((*Pos>='0') && (*Pos<='9'))
+	{
+		if (OutVal>(~(unsigned long long)0-9)/10)
+			//Overflow.
+			return false;
+
+		OutVal=OutVal*10 + (*Pos++ - '0');
+	}
+
+	return true;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "../../Header.h"
+
+namespace HTTP
+{
+
+namespace detail
+{
+
+/**Byte range request (RFC 7233) support for responses, which have a known length, and can be read from any position.
+A single range is sent as a 206 response with a Content-Range header, multiple ranges as a multipart/byteranges
+response. Invalid Range headers, and requests with a non-matching If-Range header get the full content.*/
+class ByteRanges
+{
+public:
+	enum RANGESTATE
+	{
+		RS_NONE, //Full content.
+		RS_PARTIAL,
+		RS_UNSATISFIABLE,
+	};
+
+	ByteRanges();
+
+	/**Processes the Range and If-Range headers of a request.
+	@param HeaderA The request headers, or nullptr, if range requests shouldn't be supported.
+	@param TotalLength The length of the full content.
+	@param LastModifiedStr The Last-Modified value of the content. If-Range is only accepted, if it's equal to this.
+	@param ContentType The content type of the full content.*/
+	void Init(const std::vector<Header> *HeaderA, unsigned long long TotalLength, const char *LastModifiedStr,
+		const char *ContentType);
+
+	inline RANGESTATE GetState() const { return State; }
+
+	unsigned int GetResponseCode() const;
+	/**@return The content type of the response, or nullptr, if it's the content type of the full content.*/
+	const char *GetContentType() const;
+	/**@return The length of the response body.*/
+	inline unsigned long long GetLength() const { return RespLength; }
+	/**@return True, if the response body is a single range of the content.*/
+	bool GetSingleRange(unsigned long long &OutBegin, unsigned long long &OutLength) const;
+
+	/**@return The number of the Accept-Ranges and Content-Range headers to send.*/
+	inline unsigned int GetExtraHeaderCount() const { return !IsSupported ? 0 : ContentRangeStr[0] ? 2 : 1; }
+	bool GetExtraHeader(unsigned int Index,
+		const char **OutHeader, const char **OutHeaderEnd,
+		const char **OutHeaderVal, const char **OutHeaderValEnd) const;
+
+	/**Reads the next part of the response body.
+	@param ReadFunc Functor with the signature: unsigned int ReadFunc(unsigned long long Pos, unsigned char *Target,
+		unsigned int Length). Reads from the given position of the full content, and returns the number of bytes read.
+	@return True, if the response is finished.*/
+	template<class ReadFuncType>
+	bool Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength, ReadFuncType ReadFunc)
+	{
+		OutLength=0;
+		while ((MaxLength) && (Phase!=PH_DONE))
+		{
+			if (Phase==PH_DATA)
+			{
+				const Range &CurrRange=RangeA[RangeI];
+				unsigned long long RemLength=CurrRange.End-CurrRange.Begin-PartPos;
+				unsigned int ReadLength=RemLength<MaxLength ? (unsigned int)RemLength : MaxLength;
+
+				ReadLength=ReadFunc(CurrRange.Begin+PartPos,TargetBuff,ReadLength);
+				if (!ReadLength)
+					//The content is shorter than expected.
+					return true;
+
+				PartPos+=ReadLength;
+				if (PartPos==CurrRange.End-CurrRange.Begin)
+					NextPart();
+
+				TargetBuff+=ReadLength;
+				OutLength+=ReadLength;
+				MaxLength-=ReadLength;
+			}
+			else
+			{
+				//Multipart delimiter.
+				unsigned int CopyLength=(unsigned int)(PartHeaderStr.length()-PartPos);
+				if (CopyLength>MaxLength)
+					CopyLength=MaxLength;
+
+				memcpy(TargetBuff,PartHeaderStr.data()+PartPos,CopyLength);
+				PartPos+=CopyLength;
+				if (PartPos==PartHeaderStr.length())
+				{
+					Phase=Phase==PH_PARTHEADER ? PH_DATA : PH_DONE;
+					PartPos=0;
+				}
+
+				TargetBuff+=CopyLength;
+				OutLength+=CopyLength;
+				MaxLength-=CopyLength;
+			}
+		}
+
+		return Phase==PH_DONE;
+	}
+
+private:
+	/**Maximum number of ranges in a request. Requests with more ranges get the full content.*/
+	static const unsigned int MaxRangeCount = 16;
+
+	enum PHASE
+	{
+		PH_PARTHEADER, //Delimiter and headers before a part of a multipart response.
+		PH_DATA,
+		PH_FINAL, //Closing delimiter of a multipart response.
+		PH_DONE,
+	};
+
+	struct Range
+	{
+		unsigned long long Begin, End; //[Begin, End)
+	};
+
+	bool IsSupported;
+	RANGESTATE State;
+	std::vector<Range> RangeA;
+	unsigned long long TotalLength, RespLength;
+	const char *ContentType;
+	std::string Boundary, MultipartContentType;
+	char ContentRangeStr[64]; //Empty, if no Content-Range header is sent.
+
+	PHASE Phase;
+	unsigned int RangeI;
+	unsigned long long PartPos;
+	std::string PartHeaderStr;
+
+	bool ParseRange(const char *Value);
+	/**Steps to the next range, and formats the multipart delimiter before it, if needed.*/
+	void NextPart();
+	void FormatPartHeader(unsigned int Index, std::string &Target) const;
+	void FormatFinalDelimiter(std::string &Target) const;
+
+	static bool ParseNumber(const char *&Pos, unsigned long long &OutVal);
+};
+
+}; //detail
+
+}; //HTTP
@@ -0,0 +1,72 @@
+#include "ContentCache.h"
+
+using namespace HTTP;
+using namespace HTTP::detail;
+
+ContentCache::ContentCache(unsigned long long MaxByteCount) : MaxByteCount(MaxByteCount)
+{
+	CurrStats=Stats{ 0, 0, 0, 0, 0 };
+}
+
+ContentCache::ContentPtr ContentCache::Get(const std::string &Key, const std::shared_ptr<const void> &Version)
+{
+	std::lock_guard<std::mutex> lock(CacheMtx);
+
+	auto FindI=ItemMap.find(Key);
+	if (FindI==ItemMap.end())
+	{
+		++CurrStats.MissCount;
+		return nullptr;
+	}
+
+	std::list<Item>::iterator ItemI=FindI->second;
+	if ((ItemI->Version.owner_before(Version)) || (Version.owner_before(ItemI->Version)))
+	{
+		//The content was changed since it was cached.
+		Erase(ItemI);
+		++CurrStats.MissCount;
+		return nullptr;
+	}
+
+	ItemList.splice(ItemList.begin(),ItemList,ItemI);
+	++CurrStats.HitCount;
+	return ItemI->Content;
+}
+
+void ContentCache::Put(const std::string &Key, const std::shared_ptr<const void> &Version, const ContentPtr &Content)
+{
+	if (Content->size()>MaxByteCount)
+		return;
+
+	std::lock_guard<std::mutex> lock(CacheMtx);
+
+	auto FindI=ItemMap.find(Key);
+	if (FindI!=ItemMap.end())
+		Erase(FindI->second);
+
+	while (CurrStats.ByteCount+Content->size()>MaxByteCount)
+	{
+		Erase(std::prev(ItemList.end()));
+		++CurrStats.EvictionCount;
+	}
+
+	ItemList.push_front(Item{ Key, Version, Content });
+	ItemMap[Key]=ItemList.begin();
+	CurrStats.ByteCount+=Content->size();
+	++CurrStats.EntryCount;
+}
+
+ContentCache::Stats ContentCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(CacheMtx);
+	return CurrStats;
+}
+
+void ContentCache::Erase(std::list<Item>::iterator ItemI)
+{
+	CurrStats.ByteCount-=ItemI->Content->size();
+	--CurrStats.EntryCount;
+
+	ItemMap.erase(ItemI->Key);
+	ItemList.erase(ItemI);
+}
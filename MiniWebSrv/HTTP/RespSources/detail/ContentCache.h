@@ -0,0 +1,64 @@
+#pragma once
+
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace HTTP
+{
+
+namespace detail
+{
+
+/**Byte budgeted LRU cache of response contents. Every entry is bound to a version object (for example, the metadata
+cache entry of a file): once the version changes, the cached contents are invalid.
+The methods of this class can be called from multiple threads.*/
+class ContentCache
+{
+public:
+	typedef std::shared_ptr<const std::vector<unsigned char>> ContentPtr;
+
+	struct Stats
+	{
+		unsigned long long HitCount, MissCount, EvictionCount;
+		unsigned long long ByteCount; //Total length of the cached contents.
+		unsigned int EntryCount;
+	};
+
+	/**@param MaxByteCount The maximum total length of the cached contents.*/
+	ContentCache(unsigned long long MaxByteCount);
+
+	/**@param Version The current version of the content. Only a weak reference is kept to it.
+	@return The cached content, or nullptr, if it isn't cached (or it was cached with a different version).*/
+	ContentPtr Get(const std::string &Key, const std::shared_ptr<const void> &Version);
+	/**Adds a content to the cache, evicting the least recently used entries if needed. Contents larger than the whole
+	cache are ignored.*/
+	void Put(const std::string &Key, const std::shared_ptr<const void> &Version, const ContentPtr &Content);
+
+	Stats GetStats();
+
+private:
+	struct Item
+	{
+		std::string Key;
+		std::weak_ptr<const void> Version;
+		ContentPtr Content;
+	};
+
+	const unsigned long long MaxByteCount;
+
+	std::mutex CacheMtx;
+	std::list<Item> ItemList; //Most recently used first.
+	std::unordered_map<std::string,std::list<Item>::iterator> ItemMap;
+	Stats CurrStats;
+
+	void Erase(std::list<Item>::iterator ItemI);
+};
+
+}; //detail
+
+}; //HTTP
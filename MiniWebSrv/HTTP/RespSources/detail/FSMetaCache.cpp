@@ -0,0 +1,239 @@
+#include "FSMetaCache.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#define UD_INOTIFY_SUPPORTED
+#endif
+
+using namespace HTTP;
+using namespace HTTP::detail;
+
+const std::chrono::steady_clock::duration FSMetaCache::MaxEntryAge=std::chrono::seconds(1);
+
+FSMetaCache::FSMetaCache(const boost::filesystem::path &Root, unsigned int MaxEntryCount) : Root(Root), MaxEntryCount(MaxEntryCount),
+	Generation(0), WatchFD(-1), StopFD(-1)
+{
+#ifdef UD_INOTIFY_SUPPORTED
+	WatchFD=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (WatchFD!=-1)
+	{
+		StopFD=eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+		if (StopFD!=-1)
+		{
+			try { WatchThread=std::thread(&FSMetaCache::WatchThreadFunc,this); }
+			catch (...) { }
+		}
+
+		if (!WatchThread.joinable())
+		{
+			//Fall back to expiring the entries.
+			close(WatchFD);
+			WatchFD=-1;
+			if (StopFD!=-1)
+			{
+				close(StopFD);
+				StopFD=-1;
+			}
+		}
+	}
+#endif
+}
+
+FSMetaCache::~FSMetaCache()
+{
+#ifdef UD_INOTIFY_SUPPORTED
+	if (WatchThread.joinable())
+	{
+		uint64_t StopVal=1;
+		if (write(StopFD,&StopVal,sizeof(StopVal))==sizeof(StopVal))
+			WatchThread.join();
+		else
+			WatchThread.detach();
+	}
+
+	if (WatchFD!=-1)
+		close(WatchFD);
+	if (StopFD!=-1)
+		close(StopFD);
+#endif
+}
+
+FSMetaCache::EntryPtr FSMetaCache::Get(const std::string &Resource)
+{
+	std::lock_guard<std::mutex> lock(CacheMtx);
+
+	auto FindI=EntryMap.find(Resource);
+	if (FindI==EntryMap.end())
+		return nullptr;
+
+	if ((FindI->second.IsExpiring) && (std::chrono::steady_clock::now()-FindI->second.Ptr->LoadTime>MaxEntryAge))
+	{
+		Erase(FindI);
+		return nullptr;
+	}
+
+	return FindI->second.Ptr;
+}
+
+unsigned long long FSMetaCache::Watch(const boost::filesystem::path &Path)
+{
+	if (WatchFD==-1)
+		return UnwatchedGeneration;
+
+	std::lock_guard<std::mutex> lock(CacheMtx);
+
+	if (!WatchDirs(Path))
+		return UnwatchedGeneration;
+
+	return Generation;
+}
+
+void FSMetaCache::Put(const std::string &Resource, const EntryPtr &NewEntry, unsigned long long LoadGeneration)
+{
+	std::lock_guard<std::mutex> lock(CacheMtx);
+
+	if ((LoadGeneration!=UnwatchedGeneration) && (LoadGeneration!=Generation))
+		//The file might have changed after it was read.
+		return;
+
+	if (EntryMap.size()>=MaxEntryCount)
+		Clear();
+
+	auto FindI=EntryMap.find(Resource);
+	if (FindI!=EntryMap.end())
+		Erase(FindI);
+
+	EntryMap.emplace(Resource,CachedEntry{ NewEntry, LoadGeneration==UnwatchedGeneration });
+	PathResMap.emplace(NewEntry->PathStr,Resource);
+}
+
+bool FSMetaCache::WatchDirs(const boost::filesystem::path &Path)
+{
+#ifdef UD_INOTIFY_SUPPORTED
+	//Watch every directory from the file up to the root, so renaming any of them invalidates the cache, too.
+	boost::filesystem::path CurrDir=Path.parent_path();
+	while (true)
+	{
+		if (WatchedDirS.insert(CurrDir.string()).second)
+		{
+			int NewWD=inotify_add_watch(WatchFD,CurrDir.string().c_str(),
+				IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+				IN_DELETE_SELF | IN_MOVE_SELF);
+			if (NewWD==-1)
+			{
+				WatchedDirS.erase(CurrDir.string());
+				return false;
+			}
+
+			//Adding a watch to the same directory again returns the same descriptor.
+			WatchDirMap[NewWD]=CurrDir.string();
+		}
+
+		if ((CurrDir==Root) || (!CurrDir.has_parent_path()) || (CurrDir.parent_path()==CurrDir))
+			break;
+
+		CurrDir=CurrDir.parent_path();
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void FSMetaCache::Erase(std::unordered_map<std::string,CachedEntry>::iterator Target)
+{
+	auto RangeP=PathResMap.equal_range(Target->second.Ptr->PathStr);
+	for (auto CurrI=RangeP.first; CurrI!=RangeP.second; ++CurrI)
+	{
+		if (CurrI->second==Target->first)
+		{
+			PathResMap.erase(CurrI);
+			break;
+		}
+	}
+
+	EntryMap.erase(Target);
+}
+
+void FSMetaCache::ErasePath(const std::string &Path)
+{
+	auto RangeP=PathResMap.equal_range(Path);
+	for (auto CurrI=RangeP.first; CurrI!=RangeP.second; ++CurrI)
+		EntryMap.erase(CurrI->second);
+
+	PathResMap.erase(RangeP.first,RangeP.second);
+}
+
+void FSMetaCache::Clear()
+{
+	EntryMap.clear();
+	PathResMap.clear();
+	WatchedDirS.clear(); //Watches of deleted or moved directories are invalid: re-add them as needed.
+}
+
+void FSMetaCache::WatchThreadFunc()
+{
+#ifdef UD_INOTIFY_SUPPORTED
+	pollfd PollA[2]={ { WatchFD, POLLIN, 0 }, { StopFD, POLLIN, 0 } };
+	alignas(inotify_event) char EventBuff[4096];
+	while (true)
+	{
+		if (poll(PollA,2,-1)<0)
+		{
+			if (errno==EINTR)
+				continue;
+			else
+				break;
+		}
+
+		if (PollA[1].revents)
+			break;
+
+		if (PollA[0].revents)
+		{
+			ssize_t ReadLength;
+			while ((ReadLength=read(WatchFD,EventBuff,sizeof(EventBuff)))>0)
+			{
+				std::lock_guard<std::mutex> lock(CacheMtx);
+				Generation++;
+
+				for (const char *CurrPos=EventBuff; CurrPos<EventBuff+ReadLength; )
+				{
+					const inotify_event &CurrEvent=*(const inotify_event *)CurrPos;
+					CurrPos+=sizeof(inotify_event)+CurrEvent.len;
+
+					auto DirI=WatchDirMap.find(CurrEvent.wd);
+					if ((!CurrEvent.len) || (CurrEvent.mask & (IN_ISDIR | IN_Q_OVERFLOW)) || (DirI==WatchDirMap.end()))
+					{
+						//A watched directory, or one of it's subdirectories changed: any of the cached paths might be
+						//affected.
+						Clear();
+						if ((CurrEvent.mask & IN_IGNORED) && (DirI!=WatchDirMap.end()))
+							WatchDirMap.erase(DirI);
+
+						continue;
+					}
+
+					//A file changed: remove it, and the file it might be a precompressed sibling of (foo.js.gz -> foo.js).
+					std::string ChangedPath=DirI->second;
+					if (ChangedPath.back()!='/')
+						ChangedPath+='/';
+					std::string::size_type NameBegin=ChangedPath.length();
+					ChangedPath+=CurrEvent.name;
+					ErasePath(ChangedPath);
+
+					std::string::size_type DotPos=ChangedPath.rfind('.');
+					if ((DotPos!=std::string::npos) && (DotPos>NameBegin))
+						ErasePath(ChangedPath.substr(0,DotPos));
+				}
+			}
+		}
+	}
+#endif
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <time.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <boost/filesystem.hpp>
+
+#include "../../Header.h"
+
+namespace HTTP
+{
+
+namespace detail
+{
+
+/**Cache of resolved file system resources, keyed by the requested resource string. On Linux, the directories between
+the root and the cached files are watched by an inotify watcher thread, which removes the entries of the changed files.
+On other platforms, or if inotify can't be used, entries expire after MaxEntryAge.
+The methods of this class can be called from multiple threads.*/
+class FSMetaCache
+{
+public:
+	/**The number of precompressed sibling types (see FS).*/
+	static const unsigned int PrecompressedCount = 3;
+
+	struct Entry
+	{
+		boost::filesystem::path Path; //Canonical.
+		std::string PathStr;
+		bool IsDirectory;
+		unsigned long long Size;
+		time_t LastModTime;
+		char LastModifiedStr[Header::DateStringLength + 1];
+		const char *MimeType;
+		std::chrono::steady_clock::time_point LoadTime;
+		/**The precompressed siblings of the file (foo.js.gz, ...), or nullptr for the missing ones. The siblings are
+		in the same directory, so they are invalidated together with the file.*/
+		std::shared_ptr<const Entry> PrecompressedA[PrecompressedCount];
+	};
+	typedef std::shared_ptr<const Entry> EntryPtr;
+
+	/**@param Root The canonical root directory. Changes are watched from this directory down.
+	@param MaxEntryCount When the cache has this many entries, it's cleared before adding a new one.*/
+	FSMetaCache(const boost::filesystem::path &Root, unsigned int MaxEntryCount);
+	~FSMetaCache();
+
+	FSMetaCache(const FSMetaCache &)=delete;
+	FSMetaCache &operator=(const FSMetaCache &)=delete;
+
+	/**@return The cached entry, or nullptr, if the resource isn't cached.*/
+	EntryPtr Get(const std::string &Resource);
+	/**Starts watching the directories of a file, before it's metadata is read.
+	@param Path The canonical path of the file.
+	@return The generation to pass to Put().*/
+	unsigned long long Watch(const boost::filesystem::path &Path);
+	/**Adds an entry to the cache. The entry is dropped, if anything changed in the watched directories since
+	Watch() was called.
+	@param LoadGeneration The value returned by Watch(), before the metadata of the entry was read.*/
+	void Put(const std::string &Resource, const EntryPtr &NewEntry, unsigned long long LoadGeneration);
+
+private:
+	static const std::chrono::steady_clock::duration MaxEntryAge;
+	/**Returned by Watch(), if the directories of the file couldn't be watched. These entries expire after MaxEntryAge.*/
+	static const unsigned long long UnwatchedGeneration = ~0ULL;
+
+	struct CachedEntry
+	{
+		EntryPtr Ptr;
+		bool IsExpiring; //True, if changes of the file aren't watched.
+	};
+
+	const boost::filesystem::path Root;
+	const unsigned int MaxEntryCount;
+
+	std::mutex CacheMtx;
+	std::unordered_map<std::string,CachedEntry> EntryMap;
+	std::unordered_multimap<std::string,std::string> PathResMap; //Canonical path -> the resources in EntryMap resolved to it.
+	std::unordered_set<std::string> WatchedDirS; //Directories with an inotify watch.
+	std::unordered_map<int,std::string> WatchDirMap; //Watch descriptor -> the watched directory.
+	unsigned long long Generation; //Incremented by the watcher thread for every batch of inotify events.
+
+	int WatchFD, StopFD; //inotify and eventfd descriptors, or -1.
+	std::thread WatchThread;
+
+	/**Adds inotify watches to the directories between the root and the given file. CacheMtx must be locked.
+	@return False, if a watch couldn't be added.*/
+	bool WatchDirs(const boost::filesystem::path &Path);
+	/**Removes an entry from EntryMap and PathResMap. CacheMtx must be locked.*/
+	void Erase(std::unordered_map<std::string,CachedEntry>::iterator Target);
+	/**Removes the entries resolved to a path. CacheMtx must be locked.*/
+	void ErasePath(const std::string &Path);
+	/**Removes every entry, and forgets the watched directories. CacheMtx must be locked.*/
+	void Clear();
+	void WatchThreadFunc();
+};
+
+}; //detail
+
+}; //HTTP
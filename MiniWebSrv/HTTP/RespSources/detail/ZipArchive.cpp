@@ -1,37 +1,105 @@
 #include "ZipArchive.h"
 
-#include <time.h>
+#include <string.h>
 
-ZipArchive::Stream::Stream(const FileInfo *NewInfo, std::string &ArchiveName) : Info(NewInfo), CompPos(0)
+#include <algorithm>
+#include <fstream>
+
+#include <zlib.h>
+
+#include <boost/endian/conversion.hpp>
+#include <boost/filesystem.hpp>
+
+using boost::endian::load_little_u16;
+using boost::endian::load_little_u32;
+using boost::endian::load_little_u64;
+using boost::endian::store_little_u32;
+
+const char ZipArchive::IndexMagicA[8]={ 'M', 'W', 'S', 'Z', 'I', 'D', 'X', 0 };
+
+struct ZipArchive::Stream::InflateState
+{
+	z_stream ZS;
+
+	InflateState()
+	{
+		memset(&ZS,0,sizeof(ZS));
+		//Raw deflate data, without a zlib header.
+		if (inflateInit2(&ZS,-MAX_WBITS)!=Z_OK)
+			throw Exception("Cannot initialize decompression");
+	}
+	~InflateState() { inflateEnd(&ZS); }
+};
+
+ZipArchive::Stream::Stream(const FileInfo *NewInfo, const unsigned char *Archive, std::size_t ArchiveLength, bool Decompress) :
+	Info(NewInfo), CompPos(0)
 {
-	InS.open(ArchiveName.data(),std::ios_base::binary);
-	InS.seekg(NewInfo->LocalHeaderOffset);
-	if (InS.fail())
+	static const std::size_t LFHLength=30;
+
+	if ((NewInfo->LocalHeaderOffset>ArchiveLength) || (ArchiveLength-NewInfo->LocalHeaderOffset<LFHLength))
 		throw Exception("Cannot seek to file");
 
-	char ReadBuff[30];
-	InS.read(ReadBuff,sizeof(ReadBuff));
-	if ((InS.fail()) || (*(const unsigned int *)ReadBuff!=LFHMagic))
+	const unsigned char *LocalHeader=Archive + NewInfo->LocalHeaderOffset;
+	if (load_little_u32(LocalHeader)!=LFHMagic)
 		throw Exception("Invalid zip file");
 
-	unsigned int FNLength=*(const unsigned short *)(ReadBuff+26);
-	unsigned int ExtraLength=*(const unsigned short *)(ReadBuff+28);
+	unsigned int FNLength=load_little_u16(LocalHeader+26);
+	unsigned int ExtraLength=load_little_u16(LocalHeader+28);
 
-	InS.seekg(FNLength+ExtraLength,std::ios_base::cur);
-	if (InS.fail())
+	std::size_t DataOffset=(std::size_t)NewInfo->LocalHeaderOffset + LFHLength + FNLength + ExtraLength;
+	if ((DataOffset>ArchiveLength) || (ArchiveLength-DataOffset<NewInfo->CompressedSize))
 		throw Exception("Cannot seek to file");
+
+	Data=Archive + DataOffset;
+
+	if ((Decompress) && (NewInfo->Compression==CM_DEFLATE))
+	{
+		Inflater.reset(new InflateState());
+		Inflater->ZS.next_in=(Bytef *)Data;
+	}
+}
+
+ZipArchive::Stream::Stream() : Info(nullptr), Data(nullptr), CompPos(0)
+{
+}
+
+ZipArchive::Stream::~Stream()
+{
 }
 
 unsigned int ZipArchive::Stream::Read(char *Target, unsigned int Size)
 {
-	unsigned int CompSize=Info->CompressedSize;
-	if (CompPos<CompSize)
+	if (Inflater)
+	{
+		z_stream &ZS=Inflater->ZS;
+		ZS.next_out=(Bytef *)Target;
+		ZS.avail_out=Size;
+		while (ZS.avail_out)
+		{
+			if (!ZS.avail_in)
+			{
+				//Feed the input in parts, as avail_in may be narrower than size_t.
+				unsigned long long RemLength=Info->CompressedSize - (ZS.next_in-Data);
+				ZS.avail_in=RemLength<0x40000000 ? (uInt)RemLength : 0x40000000;
+			}
+
+			if (inflate(&ZS,Z_NO_FLUSH)!=Z_OK)
+				//Either the end of the data, or corrupt data.
+				break;
+		}
+
+		unsigned int ReadLength=Size-ZS.avail_out;
+		CompPos+=ReadLength;
+		return ReadLength;
+	}
+
+	if (CompPos<Info->CompressedSize)
 	{
-		unsigned int RemSize=CompSize-CompPos;
+		unsigned long long RemSize=Info->CompressedSize-CompPos;
 		if (Size>RemSize)
-			Size=RemSize;
+			Size=(unsigned int)RemSize;
 
-		InS.read(Target,Size);
+		memcpy(Target,Data+CompPos,Size);
 		CompPos+=Size;
 		return Size;
 	}
@@ -39,20 +107,62 @@ unsigned int ZipArchive::Stream::Read(char *Target, unsigned int Size)
 		return 0;
 }
 
-ZipArchive::ZipArchive(const std::string &FileName) : ZipFN(FileName)
+void ZipArchive::Stream::Seek(unsigned long long Pos)
 {
-	ZipS.open(FileName.data(),std::ios_base::binary);
-	if (!ZipS.is_open())
-		throw Exception("Cannot open archive");
+	if (Pos>GetLength())
+		Pos=GetLength();
 
-	Load(ZipS,FileInfoMap);
+	if (Inflater)
+	{
+		if (Pos<CompPos)
+		{
+			inflateReset(&Inflater->ZS);
+			Inflater->ZS.next_in=(Bytef *)Data;
+			Inflater->ZS.avail_in=0;
+			CompPos=0;
+		}
+
+		char SkipBuff[4096];
+		while (CompPos<Pos)
+		{
+			if (!Read(SkipBuff,Pos-CompPos<sizeof(SkipBuff) ? (unsigned int)(Pos-CompPos) : (unsigned int)sizeof(SkipBuff)))
+				break;
+		}
+	}
+	else
+		CompPos=Pos;
+}
+
+ZipArchive::ZipArchive(const std::string &FileName, const std::string &IndexFileName) : ZipFN(FileName),
+	EntryBegin(nullptr), EntryEnd(nullptr), NameTable(nullptr), NameTableLength(0)
+{
+	try
+	{
+		ZipMapping=boost::interprocess::file_mapping(FileName.data(),boost::interprocess::read_only);
+		ZipRegion=boost::interprocess::mapped_region(ZipMapping,boost::interprocess::read_only);
+	}
+	catch (const boost::interprocess::interprocess_exception &)
+	{ throw Exception("Cannot open archive"); }
+
+	ZipBegin=(const unsigned char *)ZipRegion.get_address();
+	ZipLength=ZipRegion.get_size();
+
+	boost::system::error_code ModTimeErr;
+	long long ArchiveModTime=(long long)boost::filesystem::last_write_time(FileName,ModTimeErr);
+	if ((!IndexFileName.empty()) && (!ModTimeErr) && (MapIndex(IndexFileName,ArchiveModTime)))
+		return;
+
+	Load(ArchiveModTime);
+	if ((!IndexFileName.empty()) && (!ModTimeErr))
+		SaveIndex(IndexFileName);
 }
 
-const ZipArchive::FileInfo *ZipArchive::Get(const std::string &FileName)
+const ZipArchive::FileInfo *ZipArchive::Get(std::string_view FileName) const
 {
-	FIMapType::const_iterator FindI=FileInfoMap.find(FileName);
-	if (FindI!=FileInfoMap.end())
-		return &FindI->second;
+	const IndexEntry *FindI=std::lower_bound(EntryBegin,EntryEnd,FileName,
+		[this](const IndexEntry &Entry, std::string_view Name) { return GetEntryName(Entry)<Name; });
+	if ((FindI!=EntryEnd) && (GetEntryName(*FindI)==FileName))
+		return &FindI->Info;
 	else
 		return nullptr;
 }
@@ -62,40 +172,56 @@ ZipArchive::Stream *ZipArchive::GetStream(const FileInfo *Info, bool Decompress)
 	if (!Info)
 		throw Exception("Invalid FileInfo");
 
-	if (Decompress)
-		throw Exception("Decompress is not implemented");
-
-	return new Stream(Info,ZipFN);
+	return new Stream(Info,ZipBegin,ZipLength,Decompress);
 }
 
-void ZipArchive::Load(std::ifstream &Source, FIMapType &Target)
+void ZipArchive::Load(long long ArchiveModTime)
 {
-	Source.seekg(-22,std::ios_base::end);
+	static const std::size_t EOCD64LocatorLength=20, EOCD64Length=56, CDHeaderLength=46;
 
-	char ReadBuff[256];
-	Source.read(ReadBuff,22);
-	//TODO: handle non-zero length comments.
-	if ((Source.fail()) || (*(const unsigned int *)ReadBuff!=EOCDMagic))
+	const unsigned char *EOCD=FindEOCD();
+	if (!EOCD)
 		throw Exception("Not a zip archive");
 
-	unsigned short CDCount=*(const unsigned short *)(ReadBuff+10);
-	unsigned int CDOffset=*(const unsigned int *)(ReadBuff+16);
+	unsigned long long CDCount=load_little_u16(EOCD+10);
+	unsigned long long CDOffset=load_little_u32(EOCD+16);
 
-	Source.seekg(CDOffset,std::ios_base::beg);
-	if (Source.fail())
+	if (((std::size_t)(EOCD-ZipBegin)>=EOCD64LocatorLength) &&
+		(load_little_u32(EOCD-EOCD64LocatorLength)==EOCD64LocatorMagic))
+	{
+		//ZIP64 archive: the entry count and the central directory offset are stored in the ZIP64 EOCD record.
+		unsigned long long EOCD64Offset=load_little_u64(EOCD-EOCD64LocatorLength+8);
+		if ((EOCD64Offset>ZipLength) || (ZipLength-EOCD64Offset<EOCD64Length) ||
+			(load_little_u32(ZipBegin + EOCD64Offset)!=EOCD64Magic))
+			throw Exception("Not a zip archive");
+
+		const unsigned char *EOCD64=ZipBegin + EOCD64Offset;
+		CDCount=load_little_u64(EOCD64+32);
+		CDOffset=load_little_u64(EOCD64+48);
+	}
+
+	if (CDOffset>ZipLength)
 		throw Exception("Not a zip archive");
 
-	std::string CurrFN;
+	//Every entry takes at least CDHeaderLength bytes: don't trust the entry count further than that.
+	std::vector<IndexEntry> EntryA;
+	std::string Names;
+	EntryA.reserve((std::size_t)std::min<unsigned long long>(CDCount,(ZipLength-CDOffset)/CDHeaderLength));
+
+	std::size_t CurrOffset=(std::size_t)CDOffset;
 	while (CDCount)
 	{
-		Source.read(ReadBuff,46);
-		if ((*(const unsigned int *)ReadBuff!=CDMagic))
+		if (ZipLength-CurrOffset<CDHeaderLength)
+			throw Exception("Error in archive central directory");
+
+		const unsigned char *CDHeader=ZipBegin + CurrOffset;
+		if (load_little_u32(CDHeader)!=CDMagic)
 			throw Exception("Error in archive central directory");
 
 		FileInfo CurrFile;
 		{
-			unsigned short ModTime=*(const unsigned short *)(ReadBuff+12);
-			unsigned short ModDate=*(const unsigned short *)(ReadBuff+14);
+			unsigned short ModTime=load_little_u16(CDHeader+12);
+			unsigned short ModDate=load_little_u16(CDHeader+14);
 
 			tm FileModTime;
 			FileModTime.tm_year=(ModDate >> 9)+1980-1900;
@@ -107,48 +233,224 @@ void ZipArchive::Load(std::ifstream &Source, FIMapType &Target)
 			CurrFile.LastModTime=mktime(&FileModTime);
 		}
 
-		CurrFile.Compression=GetCompressionMethod(*(const unsigned short *)(ReadBuff+10));
-		CurrFile.CRC32=*(const unsigned int *)(ReadBuff+16);
-		CurrFile.CompressedSize=*(const unsigned int *)(ReadBuff+20);
-		CurrFile.UncompressedSize=*(const unsigned int *)(ReadBuff+24);
-		CurrFile.LocalHeaderOffset=*(const unsigned int *)(ReadBuff+42);
+		CurrFile.Compression=GetCompressionMethod(load_little_u16(CDHeader+10));
+		CurrFile.CRC32=load_little_u32(CDHeader+16);
+		CurrFile.CompressedSize=load_little_u32(CDHeader+20);
+		CurrFile.UncompressedSize=load_little_u32(CDHeader+24);
+		CurrFile.LocalHeaderOffset=load_little_u32(CDHeader+42);
 
-		unsigned short FNLength=*(const unsigned short *)(ReadBuff+28);
-		unsigned int ExtraLength=*(const unsigned short *)(ReadBuff+30);
-		unsigned int CommentLength=*(const unsigned short *)(ReadBuff+32);
+		unsigned int FNLength=load_little_u16(CDHeader+28);
+		unsigned int ExtraLength=load_little_u16(CDHeader+30);
+		unsigned int CommentLength=load_little_u16(CDHeader+32);
+
+		CurrOffset+=CDHeaderLength;
+		if (ZipLength-CurrOffset<(std::size_t)FNLength + ExtraLength + CommentLength)
+			throw Exception("Error in archive central directory");
 
+		if (!ReadZip64Extra(ZipBegin + CurrOffset + FNLength,ExtraLength,CurrFile))
+			throw Exception("Error in archive central directory");
+
+		//The gzip footer stores the uncompressed size modulo 2^32.
+		store_little_u32(CurrFile.GzipFooterA,CurrFile.CRC32);
+		store_little_u32(CurrFile.GzipFooterA+4,(unsigned int)CurrFile.UncompressedSize);
+
+		const char *CurrFN=(const char *)ZipBegin + CurrOffset;
+		if ((FNLength) && (CurrFN[FNLength-1]!='/'))
 		{
-			CurrFN.resize(0);
-			CurrFN.reserve(FNLength);
+			EntryA.emplace_back();
+			EntryA.back().NameOffset=Names.length();
+			EntryA.back().NameLength=FNLength;
+			EntryA.back().Info=CurrFile;
+			Names.append(CurrFN,FNLength);
+		}
 
-			while (FNLength)
-			{
-				if (FNLength<sizeof(ReadBuff))
-				{
-					Source.read(ReadBuff,FNLength);
-					CurrFN.append(ReadBuff,FNLength);
-					FNLength=0;
-				}
-				else
-				{
-					Source.read(ReadBuff,sizeof(ReadBuff));
-					CurrFN.append(ReadBuff,sizeof(ReadBuff));
-					FNLength-=sizeof(ReadBuff);
-				}
-			}
+		CurrOffset+=FNLength + ExtraLength + CommentLength;
+		CDCount--;
+	}
+
+	auto GetName=[&Names](const IndexEntry &Entry) { return std::string_view(Names).substr(Entry.NameOffset,Entry.NameLength); };
+	std::stable_sort(EntryA.begin(),EntryA.end(),
+		[&GetName](const IndexEntry &Entry1, const IndexEntry &Entry2) { return GetName(Entry1)<GetName(Entry2); });
+
+	//If a name is stored more than once, the last entry is used.
+	std::size_t EntryCount=0;
+	for (std::size_t EntryI=0; EntryI!=EntryA.size(); EntryI++)
+	{
+		if ((EntryI+1==EntryA.size()) || (GetName(EntryA[EntryI])!=GetName(EntryA[EntryI+1])))
+			EntryA[EntryCount++]=EntryA[EntryI];
+	}
+
+	//The buffer is zero filled, so the padding bytes in the saved index are deterministic.
+	IndexBuff.assign(sizeof(IndexHeader) + EntryCount*sizeof(IndexEntry) + Names.length(),0);
+
+	IndexHeader *Header=(IndexHeader *)IndexBuff.data();
+	memcpy(Header->Magic,IndexMagicA,sizeof(IndexMagicA));
+	Header->Version=IndexVersion;
+	Header->ByteOrderMark=IndexByteOrderMark;
+	Header->HeaderSize=sizeof(IndexHeader);
+	Header->EntrySize=sizeof(IndexEntry);
+	Header->ArchiveSize=ZipLength;
+	Header->ArchiveModTime=ArchiveModTime;
+	Header->EntryCount=EntryCount;
+	Header->NameTableLength=Names.length();
+
+	IndexEntry *TargetEntryA=(IndexEntry *)(IndexBuff.data() + sizeof(IndexHeader));
+	for (std::size_t EntryI=0; EntryI!=EntryCount; EntryI++)
+	{
+		TargetEntryA[EntryI].NameOffset=EntryA[EntryI].NameOffset;
+		TargetEntryA[EntryI].NameLength=EntryA[EntryI].NameLength;
+		TargetEntryA[EntryI].Info=EntryA[EntryI].Info;
+	}
+
+	memcpy(IndexBuff.data() + sizeof(IndexHeader) + EntryCount*sizeof(IndexEntry),Names.data(),Names.length());
+
+	if (!SetIndex(IndexBuff.data(),IndexBuff.size(),ArchiveModTime))
+		throw Exception("Cannot build archive index");
+}
+
+bool ZipArchive::MapIndex(const std::string &IndexFileName, long long ArchiveModTime)
+{
+	try
+	{
+		boost::interprocess::file_mapping NewMapping(IndexFileName.data(),boost::interprocess::read_only);
+		boost::interprocess::mapped_region NewRegion(NewMapping,boost::interprocess::read_only);
+
+		if (!SetIndex((const unsigned char *)NewRegion.get_address(),NewRegion.get_size(),ArchiveModTime))
+			return false;
+
+		IndexMapping.swap(NewMapping);
+		IndexRegion.swap(NewRegion);
+		return true;
+	}
+	catch (const boost::interprocess::interprocess_exception &)
+	{ return false; }
+}
+
+bool ZipArchive::SetIndex(const unsigned char *Index, std::size_t IndexLength, long long ArchiveModTime)
+{
+	if (IndexLength<sizeof(IndexHeader))
+		return false;
+
+	const IndexHeader *Header=(const IndexHeader *)Index;
+	if ((memcmp(Header->Magic,IndexMagicA,sizeof(IndexMagicA))) || (Header->Version!=IndexVersion) ||
+		(Header->ByteOrderMark!=IndexByteOrderMark) || (Header->HeaderSize!=sizeof(IndexHeader)) ||
+		(Header->EntrySize!=sizeof(IndexEntry)))
+		return false;
+
+	if ((Header->ArchiveSize!=ZipLength) || (Header->ArchiveModTime!=ArchiveModTime))
+		//The archive was changed since the index was saved.
+		return false;
+
+	std::size_t RemLength=IndexLength-sizeof(IndexHeader);
+	if ((Header->EntryCount>RemLength/sizeof(IndexEntry)) ||
+		(Header->NameTableLength!=RemLength-Header->EntryCount*sizeof(IndexEntry)))
+		return false;
+
+	EntryBegin=(const IndexEntry *)(Index + sizeof(IndexHeader));
+	EntryEnd=EntryBegin + Header->EntryCount;
+	NameTable=(const char *)EntryEnd;
+	NameTableLength=(std::size_t)Header->NameTableLength;
+	return true;
+}
+
+void ZipArchive::SaveIndex(const std::string &IndexFileName) const
+{
+	//Write a temporary file first, so a partially written index is never mapped.
+	std::string TempFileName=IndexFileName + ".tmp";
+	{
+		std::ofstream IndexF(TempFileName,std::ios::binary | std::ios::trunc);
+		IndexF.write((const char *)IndexBuff.data(),IndexBuff.size());
+		IndexF.close();
+
+		if (!IndexF)
+		{
+			boost::system::error_code RemoveErr;
+			boost::filesystem::remove(TempFileName,RemoveErr);
+			return;
 		}
+	}
 
-		if ((!CurrFN.empty()) && (CurrFN.at(CurrFN.length()-1)!='/'))
-			Target[CurrFN]=CurrFile;
+	boost::system::error_code RenameErr;
+	boost::filesystem::rename(TempFileName,IndexFileName,RenameErr);
+	if (RenameErr)
+		boost::filesystem::remove(TempFileName,RenameErr);
+}
 
-		ExtraLength+=CommentLength;
-		if (ExtraLength)
-			Source.seekg(ExtraLength,std::ios_base::cur);
+std::string_view ZipArchive::GetEntryName(const IndexEntry &Entry) const
+{
+	//A mapped index isn't trusted further than the name table.
+	if ((Entry.NameOffset>NameTableLength) || (NameTableLength-Entry.NameOffset<Entry.NameLength))
+		return std::string_view();
+	else
+		return std::string_view(NameTable + Entry.NameOffset,Entry.NameLength);
+}
 
-		CDCount--;
+const unsigned char *ZipArchive::FindEOCD() const
+{
+	static const std::size_t EOCDLength=22, MaxCommentLength=0xFFFF;
+
+	if (ZipLength<EOCDLength)
+		return nullptr;
+
+	std::size_t SearchEnd=ZipLength-EOCDLength>MaxCommentLength ? ZipLength-EOCDLength-MaxCommentLength : 0;
+	for (std::size_t CurrPos=ZipLength-EOCDLength; ; CurrPos--)
+	{
+		//The comment must fit in the rest of the archive. Some tools append data after it, so it may not end the file.
+		const unsigned char *CurrEOCD=ZipBegin + CurrPos;
+		if ((load_little_u32(CurrEOCD)==EOCDMagic) && (load_little_u16(CurrEOCD+20)<=ZipLength-CurrPos-EOCDLength))
+			return CurrEOCD;
+
+		if (CurrPos==SearchEnd)
+			return nullptr;
 	}
 }
 
+bool ZipArchive::ReadZip64Extra(const unsigned char *Extra, unsigned int ExtraLength, FileInfo &Target)
+{
+	static const unsigned long long Zip64Marker=0xFFFFFFFF;
+
+	if ((Target.UncompressedSize!=Zip64Marker) && (Target.CompressedSize!=Zip64Marker) &&
+		(Target.LocalHeaderOffset!=Zip64Marker))
+		return true;
+
+	//The extra field is a list of (ID, length, data) blocks.
+	while (ExtraLength>=4)
+	{
+		unsigned short BlockID=load_little_u16(Extra);
+		unsigned int BlockLength=load_little_u16(Extra+2);
+		Extra+=4;
+		ExtraLength-=4;
+
+		if (BlockLength>ExtraLength)
+			return false;
+
+		if (BlockID==Zip64ExtraID)
+		{
+			//The values are stored in this order, but only the ones which didn't fit into the header.
+			unsigned long long *ValueA[]={ &Target.UncompressedSize, &Target.CompressedSize, &Target.LocalHeaderOffset };
+			for (unsigned long long *CurrValue : ValueA)
+			{
+				if (*CurrValue!=Zip64Marker)
+					continue;
+
+				if (BlockLength<8)
+					return false;
+
+				*CurrValue=load_little_u64(Extra);
+				Extra+=8;
+				BlockLength-=8;
+			}
+
+			return true;
+		}
+
+		Extra+=BlockLength;
+		ExtraLength-=BlockLength;
+	}
+
+	return false;
+}
+
 ZipArchive::COMPRESSIONMETHOD ZipArchive::GetCompressionMethod(unsigned short Code)
 {
 	switch (Code)
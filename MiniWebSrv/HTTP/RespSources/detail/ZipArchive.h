@@ -1,12 +1,25 @@
 #pragma once
 
-#include <fstream>
-#include <unordered_map>
+#include <time.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+/**Read-only zip archive, with ZIP64 support. The archive is memory mapped once, and the file data is accessed directly
+in the mapping. Deflate compressed files can also be decompressed (with zlib) while reading.
+The files are looked up in a flat, sorted index built from the central directory. The index can be saved to a sidecar
+file, which is memory mapped on the next start instead of parsing the central directory again.*/
 class ZipArchive
 {
 public:
-	ZipArchive(const std::string &FileName);
+	/**@param IndexFileName The sidecar index file of the archive. If it's empty, the index is only kept in memory. If
+		the file is missing, or it doesn't match the archive (size and modification time), it's rebuilt and saved.*/
+	ZipArchive(const std::string &FileName, const std::string &IndexFileName=std::string());
 
 	class Exception : public std::runtime_error
 	{
@@ -24,43 +37,116 @@ public:
 	{
 		COMPRESSIONMETHOD Compression;
 		unsigned int CRC32;
-		std::size_t LocalHeaderOffset;
-		std::size_t CompressedSize, UncompressedSize;
+		unsigned long long LocalHeaderOffset;
+		unsigned long long CompressedSize, UncompressedSize;
 		time_t LastModTime;
+		unsigned char GzipFooterA[8]; //CRC32 and uncompressed size, in the format of a gzip footer.
 	};
 
 	class Stream
 	{
 	public:
-		Stream(const FileInfo *NewInfo, std::string &ArchiveName);
-		Stream() { }
+		/**@param Archive The whole mapped archive.
+		@param Decompress If true, the deflate compressed data of the file is decompressed by Read().*/
+		Stream(const FileInfo *NewInfo, const unsigned char *Archive, std::size_t ArchiveLength, bool Decompress=false);
+		Stream();
+		~Stream();
 
 		inline const FileInfo *GetInfo() const { return Info; }
+		/**@return The (compressed) data of the file, in the mapped archive. It's Info->CompressedSize bytes long.*/
+		inline const unsigned char *GetData() const { return Data; }
+		inline bool IsDecompressing() const { return (bool)Inflater; }
+		/**@return The length of the data returned by Read(): the uncompressed size, if decompressing.*/
+		inline unsigned long long GetLength() const { return Inflater ? Info->UncompressedSize : Info->CompressedSize; }
 		unsigned int Read(char *Target, unsigned int Size);
+		/**@return The current position in the data returned by Read().*/
+		inline unsigned long long GetPos() const { return CompPos; }
+		/**Sets the current position in the data returned by Read(). If decompressing, seeking backwards restarts the
+		decompression, and seeking forward decompresses (and drops) the data before the new position.*/
+		void Seek(unsigned long long Pos);
 
 	private:
 		static const unsigned int LFHMagic = 0x04034b50;
 
+		struct InflateState;
+
 		const FileInfo *Info;
-		std::ifstream InS;
-		unsigned int CompPos;
+		const unsigned char *Data;
+		unsigned long long CompPos;
+		std::unique_ptr<InflateState> Inflater; //Only set, if decompressing.
 	};
 
-	const FileInfo *Get(const std::string &FileName);
+	const FileInfo *Get(std::string_view FileName) const;
 	Stream *GetStream(const FileInfo *Info, bool Decompress=true);
 
+	/**@return True, if the index was loaded from the sidecar index file.*/
+	inline bool IsIndexMapped() const { return IndexRegion.get_address()!=nullptr; }
+
 protected:
 	static const unsigned int CDMagic = 0x02014b50;
 	static const unsigned int EOCDMagic = 0x06054b50;
+	static const unsigned int EOCD64Magic = 0x06064b50;
+	static const unsigned int EOCD64LocatorMagic = 0x07064b50;
+	static const unsigned short Zip64ExtraID = 0x0001;
 
-	//FileName->FileInfo map.
-	typedef std::unordered_map<std::string,FileInfo> FIMapType;
-	FIMapType FileInfoMap;
+	static const unsigned int IndexVersion = 1;
+	static const unsigned int IndexByteOrderMark = 0x01020304;
+
+	/**The index is an IndexHeader, followed by the IndexEntry array (sorted by file name), then the name table. It
+	uses the native byte order and struct layout: it's only meant to be read by the same build.*/
+	struct IndexHeader
+	{
+		char Magic[8];
+		unsigned int Version, ByteOrderMark;
+		unsigned int HeaderSize, EntrySize; //Changes with the struct layout.
+		unsigned long long ArchiveSize;
+		long long ArchiveModTime;
+		unsigned long long EntryCount;
+		unsigned long long NameTableLength;
+	};
+
+	struct IndexEntry
+	{
+		unsigned long long NameOffset; //In the name table.
+		unsigned int NameLength;
+		FileInfo Info;
+	};
+
+	static const char IndexMagicA[8];
 
 	std::string ZipFN;
-	std::ifstream ZipS;
+	boost::interprocess::file_mapping ZipMapping;
+	boost::interprocess::mapped_region ZipRegion;
+	const unsigned char *ZipBegin;
+	std::size_t ZipLength;
+
+	std::vector<unsigned char> IndexBuff; //The index, if it's not mapped.
+	boost::interprocess::file_mapping IndexMapping;
+	boost::interprocess::mapped_region IndexRegion;
+	const IndexEntry *EntryBegin, *EntryEnd;
+	const char *NameTable;
+	std::size_t NameTableLength;
+
+	/**Parses the central directory of the archive, and builds the index in IndexBuff.*/
+	void Load(long long ArchiveModTime);
+	/**Maps the sidecar index file, if it's valid for the archive.
+	@return True on success.*/
+	bool MapIndex(const std::string &IndexFileName, long long ArchiveModTime);
+	/**Sets EntryBegin, EntryEnd and NameTable from an index in memory.
+	@return False, if the index is invalid.*/
+	bool SetIndex(const unsigned char *Index, std::size_t IndexLength, long long ArchiveModTime);
+	/**Writes IndexBuff to the given file. Errors are ignored: the index is rebuilt on the next start.*/
+	void SaveIndex(const std::string &IndexFileName) const;
+
+	std::string_view GetEntryName(const IndexEntry &Entry) const;
+	/**Finds the end of central directory record. It's followed by the archive comment, which is at most 65535 bytes long.
+	@return The EOCD record, or nullptr, if it's not found.*/
+	const unsigned char *FindEOCD() const;
 
-	void Load(std::ifstream &Source, FIMapType &Target);
+	/**Reads the ZIP64 values of a file from it's extra field in the central directory. Only the values which are set to
+	0xFFFFFFFF in the central directory header are stored in the extra field.
+	@return False, if a required value is missing.*/
+	static bool ReadZip64Extra(const unsigned char *Extra, unsigned int ExtraLength, FileInfo &Target);
 
 	static COMPRESSIONMETHOD GetCompressionMethod(unsigned short Code);
 };
@@ -1,5 +1,7 @@
 #include "Server.h"
 
+#include <algorithm>
+
 #include "IRespSource.h"
 #include "IConnFilter.h"
 
@@ -7,30 +9,53 @@
 
 using namespace HTTP;
 
-const std::chrono::steady_clock::duration Server::StepDuration=std::chrono::seconds(StepDurationSeconds);
 ConnFilter::AllowAll Server::DefaultConnFilter;
 RespSource::CommonError Server::CommonErrRespSource;
 RespSource::CORSPreflight Server::CorsPFRespSource;
 ServerLog::Dummy Server::DefaultServerLog;
 
+Server::Shard::Shard(Server &Owner, boost::asio::io_context &TargetIOS, const boost::asio::ip::tcp::endpoint &ListenEndp) :
+	Owner(Owner), MyIOS(TargetIOS), MyStrand(MyIOS.get_executor()), MyStepTim(MyIOS), MyAcceptor(MyIOS,ListenEndp)
+{
+
+}
+
+Server::Shard::Shard(Server &Owner) :
+	Owner(Owner), OwnIOS(new boost::asio::io_context()), MyIOS(*OwnIOS), MyStrand(MyIOS.get_executor()), MyStepTim(MyIOS), MyAcceptor(MyIOS)
+{
+
+}
+
+void Server::Shard::OnConnectionFinished(ConnectionBase *Conn, ConnectionBase *NextConn)
+{
+	boost::asio::post(MyStrand, boost::bind(&Server::OnConnFinished, &Owner, this, Conn, NextConn));
+}
+
+void Server::Shard::OnResponseFinished(ConnectionBase *Conn)
+{
+	TotalRespCount.fetch_add(1, std::memory_order_acq_rel);
+}
+
+std::shared_ptr<IRespSource> Server::Shard::GetRespSource()
+{
+	return Owner.GetResponseSource();
+}
+
 Server::Server(unsigned short BindPort, boost::asio::io_context *Target) :
-	MyIOS(Target ? *Target : OwnIOS),
-	MyStepTim(MyIOS), ListenEndp(boost::asio::ip::tcp::v4(),BindPort), MyAcceptor(MyIOS,ListenEndp)
+	MyIOS(Target ? *Target : OwnIOS), ListenEndp(boost::asio::ip::tcp::v4(),BindPort)
 {
-	
+	ShardA.emplace_back(new Shard(*this,MyIOS,ListenEndp));
 }
 
 Server::Server(boost::asio::ip::address BindAddr, unsigned short BindPort, boost::asio::io_context *Target) :
-	MyIOS(Target ? *Target : OwnIOS),
-	MyStepTim(MyIOS), ListenEndp(BindAddr,BindPort), MyAcceptor(MyIOS,ListenEndp)
+	MyIOS(Target ? *Target : OwnIOS), ListenEndp(BindAddr,BindPort)
 {
-
+	ShardA.emplace_back(new Shard(*this,MyIOS,ListenEndp));
 }
 
 Server::~Server()
 {
 	Stop(std::chrono::steady_clock::duration(0));
-	delete MyRespSource;
 
 	if (MyConnF!=&DefaultConnFilter)
 		delete MyConnF;
@@ -62,8 +87,18 @@ void Server::SetConnectionFilter(IConnFilter *NewCF)
 
 void Server::SetResponseSource(IRespSource *NewRS)
 {
-	delete MyRespSource;
-	MyRespSource=NewRS;
+	std::shared_ptr<IRespSource> NewRSPtr(NewRS);
+	//Set before publishing the source, so it has the log, even if Run() is called at the same time.
+	if (NewRS)
+		NewRS->SetServerLog(MyLog);
+
+	//The connections keep the old source alive, while they use it.
+	std::atomic_store(&MyRespSource,NewRSPtr);
+}
+
+std::shared_ptr<IRespSource> Server::GetResponseSource()
+{
+	return std::atomic_load(&MyRespSource);
 }
 
 void Server::SetServerLog(IServerLog *NewLog)
@@ -90,18 +125,101 @@ void Server::SetConfig(const Config::Connection &ConnConf, const Config::FileUpl
 	this->FUConf = FUConf;
 }
 
+void Server::SetThreadCount(unsigned int NewThreadCount)
+{
+	if (!NewThreadCount)
+		NewThreadCount=std::max(std::thread::hardware_concurrency(), 1U);
+
+	ThreadCount=NewThreadCount;
+}
+
+bool Server::SetShardCount(unsigned int NewShardCount)
+{
+	if (!NewShardCount)
+		NewShardCount=std::max(std::thread::hardware_concurrency(), 1U);
+
+#ifdef SO_REUSEPORT
+	if ((!RunThA.empty()) || ((NewShardCount>1) && (!IsOwnIOS())))
+		return false;
+
+	ShardCount=NewShardCount;
+	return true;
+#else
+	return NewShardCount==1;
+#endif
+}
+
+unsigned int Server::GetConnCount()
+{
+	unsigned int RetVal=0;
+	for (const std::unique_ptr<Shard> &CurrShard : ShardA)
+		RetVal+=CurrShard->ConnCount.load(std::memory_order_consume);
+
+	return RetVal;
+}
+
+unsigned int Server::GetTotalConnCount()
+{
+	unsigned int RetVal=0;
+	for (const std::unique_ptr<Shard> &CurrShard : ShardA)
+		RetVal+=CurrShard->TotalConnCount.load(std::memory_order_consume);
+
+	return RetVal;
+}
+
+unsigned int Server::GetResponseCount()
+{
+	unsigned int RetVal=0;
+	for (const std::unique_ptr<Shard> &CurrShard : ShardA)
+		RetVal+=CurrShard->TotalRespCount.load(std::memory_order_consume);
+
+	return RetVal;
+}
+
 bool Server::Run()
 {
-	if (!RunTh)
+	if (RunThA.empty())
 	{
+		if (ShardA.size()>ShardCount)
+			ShardA.resize(ShardCount);
+		else if (ShardA.size()<ShardCount)
+		{
+			try
+			{
+				//Create the missing shards. Every listener socket must have SO_REUSEPORT set, including the original one.
+				ReopenAcceptor(ShardA.front().get());
+				while (ShardA.size()<ShardCount)
+				{
+					ShardA.emplace_back(new Shard(*this));
+					ReopenAcceptor(ShardA.back().get());
+				}
+			}
+			catch (...)
+			{
+				return false;
+			}
+		}
+
 		IsRunning=true;
 
-		MyRespSource->SetServerLog(MyLog);
+		if (std::shared_ptr<IRespSource> RS=GetResponseSource())
+			RS->SetServerLog(MyLog);
+
+		RunThA.reserve(ShardA.size()*ThreadCount);
+		for (std::unique_ptr<Shard> &CurrShard : ShardA)
+		{
+			if (CurrShard->OwnIOS)
+				CurrShard->MyIOS.restart();
 
-		RestartAccept();
-		RestartTimer();
+			CurrShard->WheelStartTime=std::chrono::steady_clock::now() - CurrShard->ConnWheel.GetTick()*BuildConfig::TimerResolution;
+			CurrShard->TimerTick=NoTimerTick;
+			CurrShard->IsRunning=true;
+			RestartAccept(CurrShard.get());
+
+			for (unsigned int x=0; x!=ThreadCount; ++x)
+				RunThA.emplace_back(&Server::ProcessThread, this, CurrShard.get());
+		}
 
-		RunTh=new std::thread(&Server::ProcessThread, this);
 		return true;
 	}
 	else
@@ -110,14 +228,19 @@ bool Server::Run()
 
 bool Server::Stop(std::chrono::steady_clock::duration Timeout)
 {
-	if (RunTh)
+	if (!RunThA.empty())
 	{
-		boost::asio::post(MyIOS, boost::bind(&Server::StopInternal, this));
+		IsRunning=false;
+		for (std::unique_ptr<Shard> &CurrShard : ShardA)
+			boost::asio::post(CurrShard->MyStrand, boost::bind(&Server::StopInternal, this, CurrShard.get()));
+
 		bool RetVal, IsLocked;
 		if (!RunMtx.try_lock_for(Timeout))
 		{
 			//Terminate the threads forcefully.
-			MyIOS.stop();
+			for (std::unique_ptr<Shard> &CurrShard : ShardA)
+				CurrShard->MyIOS.stop();
+
 			//Wait for the last handler invocation to return.
 			IsLocked=RunMtx.try_lock_for(std::chrono::seconds(1));
 
@@ -129,20 +252,40 @@ bool Server::Stop(std::chrono::steady_clock::duration Timeout)
 		if (IsLocked)
 			RunMtx.unlock();
 
-		if (RunTh->joinable())
-			RunTh->join();
-		else
-			RunTh->detach();
-
-		delete RunTh;
-		RunTh=nullptr;
+		for (std::thread &CurrTh : RunThA)
+		{
+			if (CurrTh.joinable())
+				CurrTh.join();
+			else
+				CurrTh.detach();
+		}
 
-		for (std::list<ConnectionBase *>::iterator NowI=ConnLst.begin(), EndI=ConnLst.end(); NowI!=EndI; ++NowI)
-			delete *NowI;
+		RunThA.clear();
 
-		ConnLst.clear();
-		try { NextConn->Stop(); delete NextConn; NextConn=nullptr; }
-		catch (...) { }
+		for (std::unique_ptr<Shard> &CurrShard : ShardA)
+		{
+			std::vector<ConnectionBase *> ConnA;
+			ConnA.reserve(CurrShard->ConnWheel.GetCount());
+			CurrShard->ConnWheel.ForEach([&ConnA](UD::Comm::TimingWheelNode *Node) { ConnA.push_back(static_cast<ConnectionBase *>(Node)); });
+			CurrShard->ConnWheel.Clear();
+
+			for (ConnectionBase *CurrConn : ConnA)
+				delete CurrConn;
+
+			for (ConnectionBase *CurrConn : CurrShard->FreeConnA)
+				delete CurrConn;
+
+			CurrShard->FreeConnA.clear();
+
+			CurrShard->ConnCount.store(0, std::memory_order_release);
+			if (CurrShard->NextConn)
+			{
+				try { CurrShard->NextConn->Stop(); }
+				catch (...) { }
+				delete CurrShard->NextConn;
+				CurrShard->NextConn=nullptr;
+			}
+		}
 
 		return RetVal;
 	}
@@ -150,109 +293,168 @@ bool Server::Stop(std::chrono::steady_clock::duration Timeout)
 		return true;
 }
 
-void Server::OnAccept(const boost::system::error_code &error)
+void Server::OnAccept(Shard *Target, const boost::system::error_code &error)
 {
 	if (!error)
 	{
-		if ((*MyConnF)(PeerEndp.address()))
+		ConnectionBase *NextConn=Target->NextConn;
+		const boost::asio::ip::tcp::endpoint &PeerEndp=Target->PeerEndp;
+		if (!Target->IsRunning)
+			//Accepted before the acceptor was closed by StopInternal().
+			NextConn->GetSocket().close();
+		else if ((*MyConnF)(PeerEndp.address()))
 		{
 			MyLog->OnConnection(NextConn,(unsigned int)PeerEndp.address().to_v4().to_uint(), true);
 
-			TotalConnCount.fetch_add(1, std::memory_order_acq_rel);
-			NextConn->Start(MyRespSource,MyLog);
-			ConnLst.push_back(NextConn);
-			NextConn=nullptr;
+			Target->TotalConnCount.fetch_add(1, std::memory_order_acq_rel);
+			NextConn->SetManager(Target);
+			NextConn->Start(MyLog);
+			AddConnection(Target,NextConn);
+			Target->NextConn=nullptr;
 		}
 		else
 		{
 			MyLog->OnConnection(NextConn,(unsigned int)PeerEndp.address().to_v4().to_uint(),false);
 
+			//The connection wasn't started: it can be used for the next accept.
 			NextConn->GetSocket().close();
-			delete NextConn; //Lazy.
-			NextConn=nullptr;
 		}
 	}
 
-	RestartAccept();
+	RestartAccept(Target);
 }
 
-void Server::OnTimer(const boost::system::error_code &error)
+void Server::OnTimer(Shard *Target, const boost::system::error_code &error)
 {
 	if (error)
 		return;
 
-	std::list<ConnectionBase *> NextConnLst;
+	Target->TimerTick=NoTimerTick;
 
-	unsigned int ActiveConnCount=0, CurrRespCount=0;
-	for (std::list<ConnectionBase *>::iterator NowI=ConnLst.begin(), EndI=ConnLst.end(); NowI!=EndI; )
+	//Only the connections with an expired timeout check are touched.
+	std::chrono::steady_clock::time_point Now=std::chrono::steady_clock::now();
+	Target->ConnWheel.Advance((Now-Target->WheelStartTime)/BuildConfig::TimerResolution,
+		[this, Target, Now](UD::Comm::TimingWheelNode *Node)
 	{
-		ConnectionBase *NextConn=nullptr;
-		if ((*NowI)->OnStep(StepDurationSeconds,&NextConn))
-		{
-			++ActiveConnCount;
-			CurrRespCount+=(*NowI)->GetResponseCount();
-			++NowI;
-		}
-		else
-		{
-			BaseRespCount+=(*NowI)->GetResponseCount();
-
-			std::list<ConnectionBase *>::iterator DelConnI=NowI;
-			++NowI;
-			delete *DelConnI;
-			ConnLst.erase(DelConnI);
-		}
+		ConnectionBase *CurrConn=static_cast<ConnectionBase *>(Node);
+		ScheduleConnection(Target,CurrConn,Now,CurrConn->OnTimer(Now));
+	});
 
-		if (NextConn)
-			NextConnLst.push_back(NextConn);
-	}
+	RestartTimer(Target);
+}
 
-	//Append the new connections to the connection list.
-	ConnLst.splice(ConnLst.end(),std::move(NextConnLst));
+void Server::OnConnFinished(Shard *Target, ConnectionBase *Conn, ConnectionBase *NextConn)
+{
+	Target->ConnWheel.Cancel(Conn);
+	Target->ConnCount.fetch_sub(1, std::memory_order_acq_rel);
 
-	ConnCount.store(ActiveConnCount, std::memory_order_release);
-	TotalRespCount.store(BaseRespCount + CurrRespCount, std::memory_order_release);
+	//Keep the connection (and it's buffers) for a later accept, if possible.
+	if ((Target->FreeConnA.size()<BuildConfig::ConnPoolSize) && (Conn->Reset()))
+		Target->FreeConnA.push_back(Conn);
+	else
+		delete Conn;
 
-	RestartTimer();
+	if (NextConn)
+	{
+		//The upgraded connection replaces the finished one. It's deleted by Stop(), if the server is already stopping.
+		NextConn->SetManager(Target);
+		NextConn->Start(MyLog);
+		AddConnection(Target,NextConn);
+		if (!Target->IsRunning)
+			NextConn->Stop();
+	}
 }
 
-void Server::StopInternal()
+void Server::StopInternal(Shard *Target)
 {
-	IsRunning=false;
-	try { MyAcceptor.close(); }
+	Target->IsRunning=false;
+	try { Target->MyAcceptor.close(); }
 	catch (...) { }
 
-	try { MyStepTim.cancel(); }
+	try { Target->MyStepTim.cancel(); }
 	catch (...) { }
 
-	for (std::list<ConnectionBase *>::iterator NowI=ConnLst.begin(), EndI=ConnLst.end(); NowI!=EndI; ++NowI)
-		(*NowI)->Stop();
+	Target->ConnWheel.ForEach([](UD::Comm::TimingWheelNode *Node) { static_cast<ConnectionBase *>(Node)->Stop(); });
 }
 
-void Server::RestartAccept()
+void Server::RestartAccept(Shard *Target)
 {
-	if (IsRunning)
+	if (Target->IsRunning)
 	{
-		if (!NextConn)
-			//Create a new HTTP Connection object.
-			NextConn=new Connection(MyIOS,&CommonErrRespSource,CorsRS,MyName.data(), ConnConf, FUConf);
+		if (!Target->NextConn)
+		{
+			if (!Target->FreeConnA.empty())
+			{
+				//Reuse a previously finished connection.
+				Target->NextConn=Target->FreeConnA.back();
+				Target->FreeConnA.pop_back();
+			}
+			else
+				//Create a new HTTP Connection object.
+				Target->NextConn=new Connection(Target->MyIOS,&CommonErrRespSource,CorsRS,MyName.data(), ConnConf, FUConf);
+		}
 
-		MyAcceptor.async_accept(NextConn->GetSocket(),PeerEndp,
-			boost::bind(&Server::OnAccept,this,boost::asio::placeholders::error));
+		Target->MyAcceptor.async_accept(Target->NextConn->GetSocket(),Target->PeerEndp,
+			boost::asio::bind_executor(Target->MyStrand,boost::bind(&Server::OnAccept,this,Target,boost::asio::placeholders::error)));
 	}
 }
 
-void Server::RestartTimer()
+void Server::RestartTimer(Shard *Target)
 {
-	if (IsRunning)
+	if ((Target->IsRunning) && (!Target->ConnWheel.IsEmpty()))
 	{
-		MyStepTim.expires_after(StepDuration);
-		MyStepTim.async_wait(boost::bind(&Server::OnTimer,this,boost::asio::placeholders::error));
+		unsigned long long NextTick=Target->ConnWheel.GetNextTick();
+		if (NextTick<Target->TimerTick)
+		{
+			//This cancels the previous wait, if any.
+			Target->TimerTick=NextTick;
+			Target->MyStepTim.expires_at(Target->WheelStartTime + NextTick*BuildConfig::TimerResolution);
+			Target->MyStepTim.async_wait(boost::asio::bind_executor(Target->MyStrand,
+				boost::bind(&Server::OnTimer,this,Target,boost::asio::placeholders::error)));
+		}
 	}
 }
 
-void Server::ProcessThread()
+void Server::AddConnection(Shard *Target, ConnectionBase *Conn)
+{
+	Target->ConnCount.fetch_add(1, std::memory_order_acq_rel);
+
+	std::chrono::steady_clock::time_point Now=std::chrono::steady_clock::now();
+	if (Target->ConnWheel.IsEmpty())
+		//Let an empty wheel catch up with the current time, so it doesn't have to step through the idle period later.
+		Target->ConnWheel.Advance((Now-Target->WheelStartTime)/BuildConfig::TimerResolution, [](UD::Comm::TimingWheelNode *) { });
+
+	ScheduleConnection(Target,Conn,Now,Conn->OnTimer(Now));
+	RestartTimer(Target);
+}
+
+void Server::ScheduleConnection(Shard *Target, ConnectionBase *Conn, std::chrono::steady_clock::time_point Now,
+	std::chrono::steady_clock::duration Delay)
+{
+	//Round up: the connection must not be checked before it's deadline.
+	std::chrono::steady_clock::duration SinceStart=Now-Target->WheelStartTime+Delay;
+	Target->ConnWheel.Schedule(Conn,(SinceStart+BuildConfig::TimerResolution-std::chrono::steady_clock::duration(1))/BuildConfig::TimerResolution);
+}
+
+void Server::ReopenAcceptor(Shard *Target)
+{
+#ifdef SO_REUSEPORT
+	typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> ReusePortOption;
+
+	boost::asio::ip::tcp::acceptor &CurrAcceptor=Target->MyAcceptor;
+	if (CurrAcceptor.is_open())
+		CurrAcceptor.close();
+
+	CurrAcceptor.open(ListenEndp.protocol());
+	CurrAcceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+	CurrAcceptor.set_option(ReusePortOption(true));
+	CurrAcceptor.bind(ListenEndp);
+	CurrAcceptor.listen();
+#endif
+}
+
+void Server::ProcessThread(Shard *Target)
 {
-	std::unique_lock<std::timed_mutex> lock(RunMtx);
-	MyIOS.run();
+	std::shared_lock<std::shared_timed_mutex> lock(RunMtx);
+	Target->MyIOS.run();
 }
@@ -1,17 +1,22 @@
 #pragma once
 
 #include <string>
-#include <list>
+#include <vector>
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
 #include <atomic>
+#include <memory>
 
 #include <boost/asio.hpp>
 
+#include "Common/TimingWheel.h"
+
 #include "BuildConfig.h"
 #include "Common.h"
 #include "ConnectionBase.h"
+#include "IConnManager.h"
 #include "ConnectionConfig.h"
 #include "FileUploadConfig.h"
 
@@ -36,40 +41,80 @@ public:
 
 	void SetCORS(bool EnableCrossOriginCalls);
 	void SetConnectionFilter(IConnFilter *NewCF);
+	/**Sets the response source, taking ownership of it. It can also be called while the server is running: the new
+	source is published atomically, and the requests which are received after this call are served by it. The old source
+	is deleted once every response it created has finished (possibly on a worker thread). Note that the connections
+	upgraded by a response (like websocket connections) aren't tracked.*/
 	void SetResponseSource(IRespSource *NewRS);
+	/**@return The current response source.*/
+	std::shared_ptr<IRespSource> GetResponseSource();
 	void SetServerLog(IServerLog *NewLog);
 	void SetName(const std::string &NewName);
 	void SetConfig(const Config::Connection &ConnConf, const Config::FileUpload &FUConf);
+	/**Sets the number of worker threads which will run the io_context. Must be called before Run().
+	@param NewThreadCount Number of threads, or 0 to use one thread for every hardware thread.*/
+	void SetThreadCount(unsigned int NewThreadCount);
+	/**Enables the shared-nothing multi-core mode: the server will open one listener socket (with SO_REUSEPORT) per shard,
+	and every shard will have it's own io_context, connection list and step timer, run by SetThreadCount() threads. The
+	incoming connections are distributed between the shards by the kernel. Must be called before Run(). Only available,
+	if the server uses it's own io_context, and the platform supports SO_REUSEPORT.
+	@param NewShardCount Number of shards, or 0 to use one shard for every hardware thread.
+	@return True, if the shard count was set.*/
+	bool SetShardCount(unsigned int NewShardCount);
 
 	bool Run();
 	bool Stop(std::chrono::steady_clock::duration Timeout);
 
-	inline unsigned int GetConnCount() { return ConnCount.load(std::memory_order_consume); }
-	inline unsigned int GetTotalConnCount() { return TotalConnCount.load(std::memory_order_consume); }
-	inline unsigned int GetResponseCount() { return TotalRespCount.load(std::memory_order_consume); }
+	unsigned int GetConnCount();
+	unsigned int GetTotalConnCount();
+	unsigned int GetResponseCount();
 
 protected:
+	/**Stores the state of one listener socket, and the connections accepted through it. Every handler of a shard is
+	executed on the shard's strand. The connections are kept in a timing wheel, ordered by their next timeout check.*/
+	struct Shard : public IConnManager
+	{
+		Shard(Server &Owner, boost::asio::io_context &TargetIOS, const boost::asio::ip::tcp::endpoint &ListenEndp);
+		Shard(Server &Owner); //Creates a new io_context, and an unopened acceptor.
+
+		virtual void OnConnectionFinished(ConnectionBase *Conn, ConnectionBase *NextConn);
+		virtual void OnResponseFinished(ConnectionBase *Conn);
+		virtual std::shared_ptr<IRespSource> GetRespSource();
+
+		Server &Owner;
+
+		std::unique_ptr<boost::asio::io_context> OwnIOS; //Only set for the additional shards.
+		boost::asio::io_context &MyIOS;
+		boost::asio::strand<boost::asio::io_context::executor_type> MyStrand; //Serializes the acceptor, timer and connection list handlers.
+		boost::asio::basic_waitable_timer<std::chrono::steady_clock> MyStepTim;
+		boost::asio::ip::tcp::acceptor MyAcceptor;
+
+		std::atomic_uint32_t ConnCount = 0;
+		std::atomic_uint32_t TotalConnCount = 0, TotalRespCount = 0;
+		UD::Comm::TimingWheel<> ConnWheel;
+		std::chrono::steady_clock::time_point WheelStartTime; //The time of the wheel's 0th tick.
+		unsigned long long TimerTick = NoTimerTick; //The tick MyStepTim is set to.
+		std::vector<ConnectionBase *> FreeConnA; //Finished connections, which can be reused.
+
+		boost::asio::ip::tcp::endpoint PeerEndp;
+		ConnectionBase *NextConn = nullptr;
+		bool IsRunning = false; //Cleared by StopInternal(). Only accessed on MyStrand, while the shard's threads run.
+	};
+
 	boost::asio::io_context &MyIOS;
 	boost::asio::io_context OwnIOS;
-	boost::asio::basic_waitable_timer<std::chrono::steady_clock> MyStepTim;
 	boost::asio::ip::tcp::endpoint ListenEndp;
-	boost::asio::ip::tcp::acceptor MyAcceptor;
+	std::vector<std::unique_ptr<Shard>> ShardA; //The first shard always uses MyIOS.
 
-	std::thread *RunTh = nullptr;
-	std::timed_mutex RunMtx;
+	std::vector<std::thread> RunThA;
+	std::shared_timed_mutex RunMtx; //Shared-locked by every running worker thread.
+	unsigned int ThreadCount = 1, ShardCount = 1;
 	IConnFilter *MyConnF = &DefaultConnFilter;
-	IRespSource *MyRespSource = nullptr;
+	std::shared_ptr<IRespSource> MyRespSource; //Only accessed with std::atomic_load and std::atomic_store.
 	IServerLog *MyLog = &DefaultServerLog;
 	std::string MyName = "EmbeddedHTTPd";
 
-	std::atomic_uint32_t ConnCount = 0;
-	std::atomic_uint32_t TotalConnCount = 0, TotalRespCount = 0;
-	unsigned int BaseRespCount = 0;
-	std::list<ConnectionBase *> ConnLst;
-
-	boost::asio::ip::tcp::endpoint PeerEndp;
-	ConnectionBase *NextConn = nullptr;
-	bool IsRunning = false;
+	std::atomic_bool IsRunning = false;
 
 	RespSource::CORSPreflight *CorsRS = nullptr;
 
@@ -81,17 +126,25 @@ protected:
 	static RespSource::CORSPreflight CorsPFRespSource;
 	static ServerLog::Dummy DefaultServerLog;
 
-	static const unsigned int StepDurationSeconds = 1;
-	static const std::chrono::steady_clock::duration StepDuration;
+	static const unsigned long long NoTimerTick = ~0ULL;
+
+	void OnAccept(Shard *Target, const boost::system::error_code &error);
+	void OnTimer(Shard *Target, const boost::system::error_code &error);
+	void OnConnFinished(Shard *Target, ConnectionBase *Conn, ConnectionBase *NextConn);
+	void StopInternal(Shard *Target);
+
+	void RestartAccept(Shard *Target);
+	void RestartTimer(Shard *Target);
 
-	void OnAccept(const boost::system::error_code &error);
-	void OnTimer(const boost::system::error_code &error);
-	void StopInternal();
+	/**Adds a new connection to the shard, and schedules it's first timeout check.*/
+	void AddConnection(Shard *Target, ConnectionBase *Conn);
+	void ScheduleConnection(Shard *Target, ConnectionBase *Conn, std::chrono::steady_clock::time_point Now,
+		std::chrono::steady_clock::duration Delay);
 
-	void RestartAccept();
-	void RestartTimer();
+	/**Reopens the listener socket of the given shard with SO_REUSEPORT set.*/
+	void ReopenAcceptor(Shard *Target);
 
-	void ProcessThread();
+	void ProcessThread(Shard *Target);
 
 	inline const bool IsOwnIOS() const { return &MyIOS==&OwnIOS; }
 };
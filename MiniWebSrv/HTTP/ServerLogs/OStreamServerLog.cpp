@@ -32,6 +32,8 @@ void PrintTransferSpeed(std::ostream &Target, double Value)
 
 void OStream::OnConnection(void *Connection, unsigned int SourceAddr, bool IsAllowed)
 {
+	std::unique_lock<std::mutex> lock(LogMtx);
+
 	if (IsAllowed)
 	{
 		ConnDataHolder &CurrHolder=ConnMap[Connection];
@@ -50,6 +52,8 @@ void OStream::OnConnection(void *Connection, unsigned int SourceAddr, bool IsAll
 
 void OStream::OnConnectionFinished(void *Connection)
 {
+	std::unique_lock<std::mutex> lock(LogMtx);
+
 	std::unordered_map<void *,ConnDataHolder>::iterator FindI=ConnMap.find(Connection);
 	if (FindI!=ConnMap.end())
 	{
@@ -72,6 +76,8 @@ void OStream::OnRequest(void *Connection, HTTP::METHOD Method, const std::string
 	double ReqTime, double RespTime,
 	void *UpgradeConn)
 {
+	std::unique_lock<std::mutex> lock(LogMtx);
+
 	std::unordered_map<void *,ConnDataHolder>::iterator FindI=ConnMap.find(Connection);
 
 	if (FindI!=ConnMap.end())
@@ -98,6 +104,8 @@ void OStream::OnRequest(void *Connection, HTTP::METHOD Method, const std::string
 
 void OStream::OnWebSocket(void *Connection, const std::string &Resource, bool IsSuccess, const char *Origin, const char *SubProtocol)
 {
+	std::unique_lock<std::mutex> lock(LogMtx);
+
 	if (IsSuccess)
 	{
 		ConnDataHolder &CurrHolder=ConnMap[Connection];
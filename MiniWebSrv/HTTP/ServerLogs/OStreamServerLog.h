@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ostream>
+#include <mutex>
 
 #include <unordered_map>
 
@@ -38,6 +39,7 @@ private:
 	};
 
 	std::ostream &TargetS;
+	std::mutex LogMtx; //The log methods can be called from multiple worker threads.
 
 	std::unordered_map<void *,ConnDataHolder> ConnMap;
 
@@ -9,16 +9,41 @@
 using namespace HTTP::WebSocket;
 
 Connection::Connection(boost::asio::ip::tcp::socket &&SrcSocket, IMsgHandler *MsgHandler) : HTTP::ConnectionBase(std::move(SrcSocket)),
+	MyStrand(boost::asio::make_strand(MySock.get_executor())),
 	SafeStates(SAFE_ALL),
-	SilentTime(0), CurrFrameLength(UnknownFrameLength), FragOpCode(OCN_CONTINUATION),
+	SilentTime(0), IsStepPending(false), IsDeletable(false),
+	CurrFrameLength(UnknownFrameLength), FragOpCode(OCN_CONTINUATION),
 	MyHandler(MsgHandler)
 {
-	//Start reading for incoming messages.
+
+}
+
+void Connection::Start(IServerLog *NewLog)
+{
+	//Start reading for incoming messages. This can't be done in the constructor: the message handler only gets it's
+	//sender after that.
 	ClearSafeState<SAFE_READ>();
 	StartAsyncRead();
 }
 
 void Connection::Stop()
+{
+	boost::asio::post(MyStrand, boost::bind(&Connection::StopInternal,this));
+}
+
+std::chrono::steady_clock::duration Connection::OnTimer(std::chrono::steady_clock::time_point Now)
+{
+	//The actual work is done on MyStrand. No new step is posted, once the connection is finished.
+	if ((!IsStepPending) && (!IsDeletable))
+	{
+		IsStepPending=true;
+		boost::asio::post(MyStrand, boost::bind(&Connection::OnStepInternal,this,Config::StepInterval));
+	}
+
+	return std::chrono::seconds(Config::StepInterval);
+}
+
+void Connection::StopInternal()
 {
 	OnProtocolError(CR_EXIT);
 
@@ -32,7 +57,7 @@ void Connection::Stop()
 	}
 }
 
-bool Connection::OnStep(unsigned int StepInterval, ConnectionBase **OutNextConn)
+void Connection::OnStepInternal(unsigned int StepInterval)
 {
 	SilentTime+=StepInterval;
 	if (SilentTime>Config::MaxSilentTime)
@@ -45,18 +70,21 @@ bool Connection::OnStep(unsigned int StepInterval, ConnectionBase **OutNextConn)
 
 		try { MySock.close(); }
 		catch (...) { }
-		return SafeStates!=SAFE_ALL;
+		IsDeletable=SafeStates==SAFE_ALL;
 	}
 	else
 	{
 		if (MyHandler)
-		{
 			MyHandler->OnStep(StepInterval);
-			return true;
-		}
 		else
-			return SafeStates!=SAFE_ALL;
+			IsDeletable=SafeStates==SAFE_ALL;
 	}
+
+	IsStepPending=false;
+
+	//This must be the last access to the object: the manager might delete it after this.
+	if (IsDeletable)
+		MyManager->OnConnectionFinished(this,nullptr);
 }
 
 unsigned char *Connection::Allocate(MESSAGETYPE Type, unsigned long long Length)
@@ -162,7 +190,7 @@ void Connection::OnWrite(const boost::system::error_code &error, std::size_t byt
 	{
 		std::unique_lock<std::mutex> lock(SendBuffMtx);
 
-		WriteBuff.Release();
+		WriteBuff.Release(bytes_transferred);
 		StartAsyncWrite();
 	}
 	else
@@ -451,7 +479,8 @@ void Connection::StartAsyncRead()
 	unsigned char *ReadPos=ReadBuff.GetReadInfo(FreeLength);
 
 	MySock.async_read_some(boost::asio::buffer(ReadPos,FreeLength),
-		boost::bind(&Connection::OnRead,this,boost::asio::placeholders::error,boost::asio::placeholders::bytes_transferred));
+		boost::asio::bind_executor(MyStrand,
+			boost::bind(&Connection::OnRead,this,boost::asio::placeholders::error,boost::asio::placeholders::bytes_transferred)));
 }
 
 void Connection::StartAsyncWrite()
@@ -459,22 +488,24 @@ void Connection::StartAsyncWrite()
 	if (!IsSafeState<SAFE_WRITE>())
 		return;
 
-	unsigned int WriteLength;
-	while (const unsigned char *WritePos=WriteBuff.Pop(WriteLength))
+	//Send every queued frame with one gather write. Only one write can be in progress at a time.
+	const std::vector<boost::asio::const_buffer> &BuffA=WriteBuff.PopAll();
+	if (!BuffA.empty())
 	{
 		ClearSafeState<SAFE_WRITE>();
-		boost::asio::async_write(MySock,boost::asio::buffer(WritePos,WriteLength),
-			boost::bind(&Connection::OnWrite,this,boost::asio::placeholders::error,boost::asio::placeholders::bytes_transferred));
+		MySock.async_write_some(BuffA,
+			boost::asio::bind_executor(MyStrand,
+				boost::bind(&Connection::OnWrite,this,boost::asio::placeholders::error,boost::asio::placeholders::bytes_transferred)));
 	}
 }
 
 
 void Connection::PostWriteReq()
 {
-	boost::asio::post(MySock.get_executor(), boost::bind(&Connection::StartAsyncWriteExternal,this));
+	boost::asio::post(MyStrand, boost::bind(&Connection::StartAsyncWriteExternal,this));
 }
 
 void Connection::PostCloseReq()
 {
-	boost::asio::post(MySock.get_executor(), boost::bind(&Connection::StartAsyncWriteCloseExternal,this));
+	boost::asio::post(MyStrand, boost::bind(&Connection::StartAsyncWriteCloseExternal,this));
 }
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <mutex>
+#include <atomic>
 
 #include "../BuildConfig.h"
 #include "../Common/StreamReadBuff.h"
@@ -24,11 +25,13 @@ class Connection : public HTTP::ConnectionBase, public IMsgSender
 {
 public:
 	Connection(boost::asio::ip::tcp::socket &&SrcSocket, IMsgHandler *MsgHandler);
-	virtual ~Connection() { Stop(); }
+	virtual ~Connection() { StopInternal(); }
 
-	virtual void Start(IRespSource *NewRespSource, IServerLog *NewLog) { }
+	/**Starts reading incoming messages. Called by the server after the upgrade has finished.*/
+	virtual void Start(IServerLog *NewLog);
+	/**Closes the connection. Can be called from any thread.*/
 	virtual void Stop();
-	virtual bool OnStep(unsigned int StepInterval, ConnectionBase **OutNextConn);
+	virtual std::chrono::steady_clock::duration OnTimer(std::chrono::steady_clock::time_point Now);
 
 	virtual std::mutex &GetSendMutex() { return SendBuffMtx; }
 	virtual unsigned char *Allocate(MESSAGETYPE Type, unsigned long long Length);
@@ -68,10 +71,13 @@ private:
 		SAFE_ALL = SAFE_READ | SAFE_WRITE,
 	};
 
+	boost::asio::strand<boost::asio::any_io_executor> MyStrand; //Every handler of the connection runs on this strand.
+
 	std::mutex SendBuffMtx;
 	unsigned int SafeStates;
 
 	unsigned int SilentTime;
+	std::atomic_bool IsStepPending, IsDeletable; //Used by OnTimer(), which can be called from a different thread.
 
 	unsigned long long CurrFrameLength; //Currently read total frame length (including header).
 
@@ -86,6 +92,9 @@ private:
 	static const unsigned long long UnknownFrameLength = ~(unsigned long long)0;
 	static const bool AllowMaskedOnly = true;
 
+	void StopInternal();
+	void OnStepInternal(unsigned int StepInterval);
+
 	void OnRead(const boost::system::error_code &error, std::size_t bytes_transferred);
 	void OnWrite(const boost::system::error_code &error, std::size_t bytes_transferred);
 
@@ -6,7 +6,10 @@
 #include <sstream>
 #include <optional>
 
+#include <boost/crc.hpp>
+
 #include "HTTP/Server.h"
+#include "HTTP/AsyncFileWriter.h"
 #include "HTTP/RespSources/FSRespSource.h"
 #include "HTTP/RespSources/ZipRespSource.h"
 #include "HTTP/RespSources/WSEchoRespSource.h"
@@ -14,6 +17,7 @@
 #include "HTTP/RespSources/StaticRespSource.h"
 #include "HTTP/RespSources/GenericRespSource.h"
 #include "HTTP/RespSources/CoroRespSource.h"
+#include "HTTP/RespSources/GzipRespSource.h"
 #include "HTTP/ServerLogs/OStreamServerLog.h"
 
  //////////////////////////////////////
@@ -24,6 +28,7 @@
 #endif
 
 volatile bool IsRunning=true;
+volatile bool IsReloadRequested=false;
 #ifdef _MSC_VER
 HANDLE MainThreadH=INVALID_HANDLE_VALUE;
 
@@ -47,6 +52,8 @@ void SigHandler(int sig)
 {
 	if ((sig==SIGQUIT) || (sig==SIGINT))
 		IsRunning=false;
+	else if (sig==SIGHUP)
+		IsReloadRequested=true;
 }
 #endif
 
@@ -114,6 +121,103 @@ public:
 	}
 };
 
+ //////////////////////////////////////
+// Streamed request body tester.
+
+class StreamTestRS : public HTTP::IRespSource
+{
+public:
+
+	/**Counts the bytes of the request body, and calculates it's CRC32 while it arrives, without buffering it.*/
+	class CountResp : public HTTP::IResponse
+	{
+	public:
+		CountResp(unsigned long long MaxLength) : MaxLength(MaxLength), Length(0), ReadPos(0) { }
+
+		virtual unsigned int GetResponseCode() { return Length<=MaxLength ? HTTP::RC_OK : HTTP::RC_PAYLOADTOOLARGE; }
+		virtual const char *GetContentType() const { return "text/plain"; }
+
+		virtual unsigned long long GetLength() { return GetResult().length(); }
+		virtual bool Read(unsigned char *TargetBuff, unsigned int MaxLength, unsigned int &OutLength, boost::asio::yield_context &Ctx)
+		{
+			const std::string &Result=GetResult();
+			OutLength=(unsigned int)std::min<std::size_t>(MaxLength,Result.length()-ReadPos);
+			memcpy(TargetBuff,Result.data()+ReadPos,OutLength);
+			ReadPos+=OutLength;
+			return ReadPos==Result.length();
+		}
+
+		virtual bool OnBodyData(const unsigned char *Begin, const unsigned char *End, boost::asio::yield_context &Ctx)
+		{
+			Length+=End-Begin;
+			if (Length>MaxLength)
+				return false;
+
+			CRC.process_block(Begin,End);
+			return true;
+		}
+
+		/**Rejects the body before reading any of it.*/
+		inline void Reject() { Length=MaxLength+1; }
+
+	private:
+		unsigned long long MaxLength, Length;
+		boost::crc_32_type CRC;
+		std::string Result;
+		std::size_t ReadPos;
+
+		const std::string &GetResult()
+		{
+			if (Result.empty())
+			{
+				std::stringstream ResultStream;
+				if (Length<=MaxLength)
+					ResultStream << "Received " << Length << " bytes, CRC32: " << std::hex << CRC.checksum() << "\n";
+				else
+					ResultStream << "Request body too large. Maximum length: " << MaxLength << " bytes.\n";
+
+				Result=ResultStream.str();
+			}
+
+			return Result;
+		}
+	};
+
+	virtual bool IsBodyStreamed(HTTP::METHOD Method, const std::string &Resource, const std::vector<HTTP::Header> &HeaderA) override
+	{
+		return true;
+	}
+
+	virtual HTTP::IResponse *OnExpectContinue(HTTP::METHOD Method, std::string &Resource, HTTP::QueryParams &Query, std::vector<HTTP::Header> &HeaderA,
+		AsyncHelperHolder AsyncHelpers, void *ParentConn) override
+	{
+		//Reject too long bodies, before the client sends them.
+		std::unique_ptr<CountResp> MyResp(CreateCountResp(Query,HeaderA));
+		return MyResp->GetResponseCode()!=HTTP::RC_OK ? MyResp.release() : nullptr;
+	}
+
+	virtual HTTP::IResponse *Create(HTTP::METHOD Method, std::string &Resource, HTTP::QueryParams &Query, std::vector<HTTP::Header> &HeaderA,
+		unsigned char *ContentBuff, unsigned char *ContentBuffEnd, AsyncHelperHolder AsyncHelpers, void *ParentConn) override
+	{
+		return CreateCountResp(Query,HeaderA);
+	}
+
+private:
+	static CountResp *CreateCountResp(HTTP::QueryParams &Query, std::vector<HTTP::Header> &HeaderA)
+	{
+		const std::string *MaxLengthStr=Query.GetPtr("max");
+		unsigned long long MaxLength=MaxLengthStr ? strtoull(MaxLengthStr->c_str(),nullptr,10) : ~(unsigned long long)0;
+		CountResp *MyResp=new CountResp(MaxLength);
+
+		//Reject too long bodies based on their declared length, before reading them.
+		for (const HTTP::Header &CurrHeader : HeaderA)
+			if ((CurrHeader.IntName==HTTP::HN_CONTENT_LENGTH) && (CurrHeader.GetULongLong()>MaxLength))
+				MyResp->Reject();
+
+		return MyResp;
+	}
+};
+
  //////////////////////////////////////
 // Main entry point.
 
@@ -125,21 +229,34 @@ int main(int argc, char* argv[])
 #else
 	signal(SIGQUIT,&SigHandler);
 	signal(SIGINT,&SigHandler);
+	signal(SIGHUP,&SigHandler);
 #endif
 
 	std::string StaticRespStr("<h1>Static response, resource embedded in executable</h1>");
 
 	std::cout << "Starting." << std::endl;
 	HTTP::Server MiniWS(8880);
+	HTTP::RespSource::FS *DocRS;
+	HTTP::RespSource::Zip *GalleryRS;
 	MiniWS.SetName("MiniWebServer/v0.2.0");
 
+	{
+		//The files uploaded to /formtest are written by dedicated threads, instead of the server's threads.
+		HTTP::Config::FileUpload FUConf;
+		FUConf.Writer=std::make_shared<HTTP::AsyncFileWriter>();
+		MiniWS.SetConfig(HTTP::Config::Connection(),FUConf);
+	}
+
 	{
 		HTTP::RespSource::Combiner *Combiner=new HTTP::RespSource::Combiner();
-		Combiner->AddRespSource("/gallery",new HTTP::RespSource::Zip("../Doc/gallery.zip"));
+		GalleryRS=new HTTP::RespSource::Zip("../Doc/gallery.zip");
+		Combiner->AddRespSource("/gallery",GalleryRS);
 		Combiner->AddRespSource("/formtest",new FormTestRS());
+		Combiner->AddRespSource("/streamtest",new StreamTestRS());
 		Combiner->AddRespSource("/echo",new HTTP::WebSocket::EchoRespSource());
 		Combiner->AddRespSource("/static", new HTTP::RespSource::StaticRespSource(&StaticRespStr, "text/html"), true);
-		Combiner->AddRespSource("/corotest", HTTP::RespSource::make_coro_respsource(
+		//The responses of the coroutine are compressed on the fly, for clients which accept gzip.
+		Combiner->AddRespSource("/corotest", new HTTP::RespSource::Gzip(HTTP::RespSource::make_coro_respsource(
 			[](const HTTP::RespSource::GenericBase::CallParams &CParams, HTTP::RespSource::CoroResponse::ResponseParams &RParams, HTTP::RespSource::CoroResponse::OutStream &OutS) {
 
 			std::chrono::steady_clock::duration SleepDuration;
@@ -175,9 +292,10 @@ int main(int argc, char* argv[])
 			}
 
 			//Exiting the coroutine will finalize the response.
-		}));
+		})));
 
-		Combiner->AddRespSource("", new HTTP::RespSource::FS("../Doc"));
+		DocRS=new HTTP::RespSource::FS("../Doc",16*1024*1024);
+		Combiner->AddRespSource("", DocRS);
 
 		Combiner->AddRedirect("/","/test.html");
 
@@ -189,13 +307,32 @@ int main(int argc, char* argv[])
 	MiniWS.Run();
 	std::cout << "Started." << std::endl;
 	while (IsRunning)
+	{
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
+		if (IsReloadRequested)
+		{
+			//SIGHUP: serve the current version of the archive, without stopping the server.
+			IsReloadRequested=false;
+			try
+			{
+				GalleryRS->Reload("../Doc/gallery.zip");
+				std::cout << "Reloaded gallery.zip." << std::endl;
+			}
+			catch (const std::exception &Ex)
+			{ std::cout << "Cannot reload gallery.zip: " << Ex.what() << std::endl; }
+		}
+	}
+
 	std::cout << "Stopping." << std::endl;
 	if (MiniWS.Stop(std::chrono::seconds(4)))
 		std::cout << "Stopped gracefully." << std::endl;
 	else
 		std::cout << "Stopped forcefully." << std::endl;
 
+	HTTP::detail::ContentCache::Stats CacheStats=DocRS->GetContentCacheStats();
+	std::cout << "Content cache: " << CacheStats.HitCount << " hits, " << CacheStats.MissCount << " misses, " <<
+		CacheStats.EvictionCount << " evictions." << std::endl;
+
 	return 0;
 }